@@ -8,7 +8,16 @@ struct buf {
   struct buf *next;
   struct buf *qnext; // disk queue
   uchar data[BSIZE];
+
+  // Raw swap I/O (see swap.c): whole pages starting at blockno,
+  // moved straight from/to pages[] instead of data.
+  uint npages;       // # of pages, 0 for a regular block
+  char **pages;
+  uint nxfer;        // sectors transferred so far
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
 
+// Sector i of a swap transfer
+#define SWAPSECT(b, i) ((b)->pages[(i) / (PGSIZE / BSIZE)] + ((i) % (PGSIZE / BSIZE)) * BSIZE)
+
@@ -2,13 +2,17 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct memstats;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct segment;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 typedef uint pte_t;
 
@@ -35,6 +39,7 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewriteat(struct file*, char*, int n, uint);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
@@ -54,10 +59,6 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
-int		createSwapFile(struct proc* p);
-int		readFromSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size);
-int		writeToSwapFile(struct proc* p, char* buffer, uint placeOnFile, uint size);
-int		removeSwapFile(struct proc* p);
 
 // ide.c
 void            ideinit(void);
@@ -74,6 +75,10 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kincref(char*);
+int             krefcount(char*);
+int             kfreecount(void);
+char*           kalloclarge(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -107,6 +112,19 @@ void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
+// mmap.c
+int             mmap(uint, int, int, struct file*, uint);
+int             munmap(uint, uint);
+void            unmapall(void);
+int             mmapfault(struct proc*, char*, int);
+int             copymaps(pde_t*, struct proc*);
+void            dupmaps(struct proc*, struct proc*);
+uint            mmapbase(struct proc*);
+uint            userend(struct proc*, uint);
+struct vma*     findvma(struct proc*, uint);
+struct vma*     vmaalloc(struct proc*, uint);
+void            mmapsync(struct proc*, struct vma*, uint, uint);
+
 //PAGEBREAK: 16
 // proc.c
 int             cpuid(void);
@@ -123,10 +141,52 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            pageoutinit(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
-uint            page_fault_handler();
+uint            page_fault_handler(uint);
+int             set_ram_limit(int);
+void            policy_tick(void);
+int             set_policy(int, int);
+int             split_large_page(struct proc*, char*);
+void            make_room(uint);
+void            add_resident_page(struct proc*, char*, int);
+void            pages_freed(struct proc*, uint, uint);
+void            forget_range(struct proc*, uint, uint);
+int             madvise(uint, uint, int);
+int             mlock(uint, uint);
+int             munlock(uint, uint);
+int             pin(uint, uint, int, uint*);
+void            unpin(uint, uint);
+int             filebacked(uint, uint);
+int             getmemstats(int, struct memstats*);
+
+// rset.c
+int             rsreserve(struct proc*, uint);
+void            rspush(struct proc*, char*);
+char*           rspop(struct proc*);
+char*           rsget(struct proc*, uint);
+uint*           rsage(struct proc*, uint);
+void            rsremove(struct proc*, uint);
+void            rsrotate(struct proc*);
+int             rsdel(struct proc*, char*);
+void            rsdrop(struct proc*, uint, uint);
+int             rsdup(struct proc*, struct proc*);
+void            rsfree(struct proc*);
+
+// swap.c
+void            swapinit(void);
+int             swapalloc(int);
+void            swapdup(int);
+void            swapfree(int);
+void            swapread(int, char**, int);
+void            swapwrite(int, char**, int);
+void            swapcacheadd(char*, int);
+int             swapcachedup(char*);
+void            swapcachedel(char*);
+void            swaplock(void);
+void            swapunlock(void);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -135,6 +195,16 @@ void            swtch(struct context**, struct context*);
 struct inode*	create(char *path, short type, short major, short minor);
 int				isdirempty(struct inode *dp);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, uint);
+int             shmat(int);
+int             shmdt(uint);
+int             shmrm(int);
+int             shmmap(pde_t*, struct shm*, uint);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -162,6 +232,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -190,8 +261,14 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
+int             loadpage(pde_t*, struct inode*, struct segment*, int, char*, int);
+int             mapzero(pde_t*, char*);
+int             mapshared(pde_t*, char*, char*, int);
+int             maplarge(pde_t*, char*);
+int             splitlarge(pde_t*, char*);
+int             zeromapped(pte_t*);
 pde_t*          copyuvm(pde_t*, uint);
+int             copyrange(pde_t*, pde_t*, uint, uint, int);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
@@ -200,5 +277,8 @@ int             light_page_flags(char *user_virtual_address, int flags);
 int             check_page_flags(char *user_virtual_address, int flags);
 int             turn_off_page_flags(char *user_virtual_address, int flags);
 pte_t *  walkpgdir(pde_t *pgdir, const void *va, int alloc);
+int             copy_on_write(pte_t *pte, char *uva);
+void            evict_frame(pde_t *pgdir, char *uva, int slot);
+void            map_swapped_in(pte_t *pte, char *uva, char *mem);
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -6,6 +6,10 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
 int
 exec(char *path, char **argv) {
@@ -15,7 +19,10 @@ exec(char *path, char **argv) {
     struct elfhdr elf;
     struct inode *ip;
     struct proghdr ph;
+    struct segment segs[NELFSEG];
+    int nseg;
     pde_t *pgdir, *oldpgdir;
+    struct inode *exe, *oldexe;
     struct proc *curproc = myproc();
 
 
@@ -28,6 +35,7 @@ exec(char *path, char **argv) {
     }
     ilock(ip);
     pgdir = 0;
+    exe = 0;
 
     // Check ELF header
     if (readi(ip, (char *) &elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,8 +46,10 @@ exec(char *path, char **argv) {
     if ((pgdir = setupkvm()) == 0)
         goto bad;
 
-    // Load program into memory.
+    // Note where the program goes in memory. Its pages are read
+    // in from ip when they are first touched, see map_new_page().
     sz = 0;
+    nseg = 0;
     for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
         if (readi(ip, (char *) &ph, off, sizeof(ph)) != sizeof(ph))
             goto bad;
@@ -47,17 +57,24 @@ exec(char *path, char **argv) {
             continue;
         if (ph.memsz < ph.filesz)
             goto bad;
-        if (ph.vaddr + ph.memsz < ph.vaddr)
-            goto bad;
-        if ((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+        if (ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz >= KERNBASE)
             goto bad;
         if (ph.vaddr % PGSIZE != 0)
             goto bad;
-        if (loaduvm(pgdir, (char *) ph.vaddr, ip, ph.off, ph.filesz) < 0)
+        if (ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
+            goto bad;
+        if (nseg == NELFSEG)
             goto bad;
+        segs[nseg].vaddr = ph.vaddr;
+        segs[nseg].filesz = ph.filesz;
+        segs[nseg].off = ph.off;
+        nseg++;
+        if (ph.vaddr + ph.memsz > sz)
+            sz = ph.vaddr + ph.memsz;
     }
-    iunlockput(ip);
+    iunlock(ip);
     end_op();
+    exe = ip;
     ip = 0;
 
     // Allocate two pages at the next page boundary.
@@ -93,27 +110,47 @@ exec(char *path, char **argv) {
             last = s + 1;
     safestrcpy(curproc->name, last, sizeof(curproc->name));
 
+    // Commit to the user image. The page-out daemon must not rob the
+    // process while its page table and resident set are replaced.
+    curproc->paging++;
+    unmapall();
     curproc->total_size = sz;
-    curproc->ram_size = curproc->total_size;
-    // Commit to the user image.
+    curproc->ram_size = 2 * PGSIZE;  // just the stack and its guard page
     oldpgdir = curproc->pgdir;
     curproc->pgdir = pgdir;
+    oldexe = curproc->exe;
+    curproc->exe = exe;
+    for (i = 0; i < nseg; i++)
+        curproc->segs[i] = segs[i];
+    curproc->nseg = nseg;
 
     // clean pages_on_ram entry's
-    curproc->pages_on_ram_stack_pointer = 0;
-    memset(curproc->pages_on_ram, 0, sizeof(char *) * 16);
-
-    // reset swapFile
-    memset(curproc->swapped_pages_entry, 0, sizeof(char *) * 16);
+    rsfree(curproc);
+    curproc->paging--;
 
 
     curproc->tf->eip = elf.entry;  // main
     curproc->tf->esp = sp;
     curproc->total_paged_out = 0;
     curproc->page_faults = 0;
+    curproc->major_faults = 0;
+    curproc->pages_in = 0;
+    curproc->swap_bytes = 0;
+    curproc->fault_cycles = 0;
+    curproc->swap_cycles = 0;
+    curproc->last_fault = 0;
+    curproc->fault_stride = 0;
+    curproc->readahead = 0;
     curproc->protected_pages = 0;
+    memset(curproc->advice, 0, sizeof(curproc->advice));
+    memset(curproc->mlocks, 0, sizeof(curproc->mlocks));
     switchuvm(curproc);
     freevm(oldpgdir);
+    if (oldexe) {
+        begin_op();
+        iput(oldexe);
+        end_op();
+    }
     return 0;
 
     bad:
@@ -123,5 +160,10 @@ exec(char *path, char **argv) {
         iunlockput(ip);
         end_op();
     }
+    if (exe) {
+        begin_op();
+        iput(exe);
+        end_op();
+    }
     return -1;
 }
@@ -70,30 +70,39 @@ ideinit(void)
 }
 
 // Start the request for b.  Caller must hold idelock.
+// A swap request moves b->npages pages in a single command,
+// one sector per interrupt (see ideintr).
 static void
 idestart(struct buf *b)
 {
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= FSSIZE + SWAPSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int nsect = sector_per_block;
 
   if (sector_per_block > 7) panic("idestart");
+  if(b->npages){
+    if(sector_per_block != 1 || b->npages * (PGSIZE/SECTOR_SIZE) > 256)
+      panic("idestart: swap");
+    nsect = b->npages * (PGSIZE/SECTOR_SIZE);
+    b->nxfer = 0;
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect & 0xff);  // number of sectors, 0 means 256
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    outsl(0x1f0, b->npages ? SWAPSECT(b, 0) : (char*)b->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -112,11 +121,23 @@ ideintr(void)
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(b->npages){
+    // Swap transfer: one sector done, move on to the next one.
+    if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+      insl(0x1f0, SWAPSECT(b, b->nxfer), SECTOR_SIZE/4);
+    if(++b->nxfer < b->npages * (PGSIZE/SECTOR_SIZE)){
+      if(b->flags & B_DIRTY){
+        idewait(0);
+        outsl(0x1f0, SWAPSECT(b, b->nxfer), SECTOR_SIZE/4);
+      }
+      release(&idelock);
+      return;
+    }
+  } else if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+    insl(0x1f0, b->data, BSIZE/4);  // Read data if needed.
+
+  idequeue = b->qnext;
 
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
@@ -1,6 +1,7 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and 4 MB large
+// pages from memory kept back for them.
 
 #include "types.h"
 #include "defs.h"
@@ -13,6 +14,8 @@ void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+#define LARGEBASE (PHYSTOP - NLARGEPAGE * LPGSIZE)  // the large pages kept back
+
 struct run {
   struct run *next;
 };
@@ -21,6 +24,9 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  uint nfree;  // # of pages on freelist
+  uint nlarge[NLARGEPAGE];  // # of pages of each large page still in use
+  uint ref[PHYSTOP >> PGSHIFT];  // # of mappings of each page (copy-on-write)
 } kmem;
 
 // Initialization happens in two phases.
@@ -36,9 +42,13 @@ kinit1(void *vstart, void *vend)
   freerange(vstart, vend);
 }
 
+// The top NLARGEPAGE large pages of memory are kept back for
+// kalloclarge().
 void
 kinit2(void *vstart, void *vend)
 {
+  if(V2P(vend) > LARGEBASE)
+    vend = P2V(LARGEBASE);
   freerange(vstart, vend);
   kmem.use_lock = 1;
 }
@@ -48,14 +58,17 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p) >> PGSHIFT] = 1;
     kfree(p);
+  }
 }
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed once no page table maps it anymore.
 void
 kfree(char *v)
 {
@@ -64,6 +77,27 @@ kfree(char *v)
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(kmem.ref[V2P(v) >> PGSHIFT] == 0)
+    panic("kfree: ref");
+  if(--kmem.ref[V2P(v) >> PGSHIFT] > 0){
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  swapcachedel(v);
+
+  if(V2P(v) >= LARGEBASE){
+    // Part of a large page, free again once all of it is
+    acquire(&kmem.lock);
+    kmem.nlarge[(V2P(v) - LARGEBASE) / LPGSIZE]--;
+    release(&kmem.lock);
+    return;
+  }
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
@@ -72,6 +106,7 @@ kfree(char *v)
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   if(kmem.use_lock)
     release(&kmem.lock);
 }
@@ -87,10 +122,70 @@ kalloc(void)
   if(kmem.use_lock)
     acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
+    kmem.nfree--;
+    kmem.ref[V2P(r) >> PGSHIFT] = 1;
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
   return (char*)r;
 }
 
+// Allocate a large page: LPGSIZE bytes of physical memory, aligned
+// to LPGSIZE. Its pages are reference counted and freed one by one,
+// like any others. Returns 0 if none is free.
+char*
+kalloclarge(void)
+{
+  char *v;
+  int i, j;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < NLARGEPAGE; i++){
+    if(kmem.nlarge[i] == 0){
+      v = P2V(LARGEBASE + i * LPGSIZE);
+      for(j = 0; j < NPTENTRIES; j++)
+        kmem.ref[(V2P(v) >> PGSHIFT) + j] = 1;
+      kmem.nlarge[i] = NPTENTRIES;
+      release(&kmem.lock);
+      return v;
+    }
+  }
+  release(&kmem.lock);
+  return 0;
+}
+
+// Add a reference to an allocated page, e.g. when fork()
+// maps it copy-on-write into the child.
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[V2P(v) >> PGSHIFT] == 0)
+    panic("kincref: free page");
+  kmem.ref[V2P(v) >> PGSHIFT]++;
+  release(&kmem.lock);
+}
+
+// Number of page tables mapping the page at v.
+int
+krefcount(char *v)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[V2P(v) >> PGSHIFT];
+  release(&kmem.lock);
+  return n;
+}
+
+// Number of free pages.
+int
+kfreecount(void)
+{
+  return kmem.nfree;
+}
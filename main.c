@@ -30,10 +30,13 @@ main(void)
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  swapinit();      // swap slots
+  shminit();       // shared memory segments
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
   userinit();      // first user process
+  pageoutinit();   // page-out daemon
   mpmain();        // finish this processor's setup
 }
 
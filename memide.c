@@ -51,6 +51,20 @@ iderw(struct buf *b)
 
   p = memdisk + b->blockno*BSIZE;
 
+  if(b->npages){
+    if(b->blockno + b->npages*(PGSIZE/BSIZE) > disksize)
+      panic("iderw: swap out of range");
+    for(b->nxfer = 0; b->nxfer < b->npages*(PGSIZE/BSIZE); b->nxfer++, p += BSIZE){
+      if(b->flags & B_DIRTY)
+        memmove(p, SWAPSECT(b, b->nxfer), BSIZE);
+      else
+        memmove(SWAPSECT(b, b->nxfer), p, BSIZE);
+    }
+    b->flags &= ~B_DIRTY;
+    b->flags |= B_VALID;
+    return;
+  }
+
   if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
     memmove(p, b->data, BSIZE);
@@ -0,0 +1,14 @@
+// Memory and paging counters of a process, see getmemstats().
+// The counters count from the process's last exec (or fork).
+struct memstats {
+  uint minor_faults;    // Page faults served without reading swap or a file
+  uint major_faults;    // Page faults that read swap or a file
+  uint pages_in;        // Pages read back from swap
+  uint pages_out;       // Pages paged out
+  uint swap_bytes;      // Bytes its page-outs wrote to swap
+  uint resident_pages;  // Pages in RAM now
+  uint swapped_pages;   // Pages in swap now, 0 for another process running now
+  uint locked_pages;    // Pages locked by mlock()
+  uint64 fault_cycles;  // Time in the page fault handler, in TSC cycles
+  uint64 swap_cycles;   // Time in swap I/O, in TSC cycles
+};
@@ -0,0 +1,15 @@
+// mmap() protections
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+// mmap() flags
+#define MAP_SHARED  0x1  // writes go back to the file at munmap()
+#define MAP_PRIVATE 0x2  // writes stay in the process
+#define MAP_ANON    0x4  // zeroed memory, no file
+
+// madvise() advice
+#define MADV_NORMAL     0  // no particular pattern
+#define MADV_WILLNEED   1  // page in the paged out pages now
+#define MADV_DONTNEED   2  // drop the pages and their swap slots now
+#define MADV_SEQUENTIAL 3  // read ahead far, page out what was passed
+#define MADV_RANDOM     4  // don't read ahead
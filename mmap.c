@@ -0,0 +1,324 @@
+// Memory mappings.
+//
+// mmap() maps zeroed memory (MAP_ANON) or part of a file into a new
+// range of user addresses, which the process keeps as a vma. Mappings
+// go down from KERNBASE, and the heap may only grow up to the lowest
+// one. Like heap that sbrk() reserved, a mapping costs nothing until
+// it is touched: mmapfault() gives each page a frame on its first
+// fault, read from the file or zeroed.
+//
+// Pages of private mappings are in the resident set and get paged
+// out like any other. Pages of shared file mappings stay in RAM:
+// their dirty ones are written back to the file when they are
+// unmapped, by munmap(), exec() or exit(). After fork() the child's
+// writes to them go to its own copies, which it writes back itself.
+// Shared memory segments (shm.c) are attached as mappings as well.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+
+// Return p's mapping containing addr, or 0.
+struct vma*
+findvma(struct proc *p, uint addr)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->end != 0 && addr >= v->start && addr < v->end)
+      return v;
+  return 0;
+}
+
+// Return where p's lowest mapping starts, which the heap can't
+// grow past, or KERNBASE if it has none.
+uint
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint base = KERNBASE;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->end != 0 && v->start < base)
+      base = v->start;
+  return base;
+}
+
+// Return the end of the part of p's address space around addr:
+// the heap or a mapping. Returns 0 if addr isn't mapped.
+uint
+userend(struct proc *p, uint addr)
+{
+  struct vma *v;
+
+  if(addr < p->total_size)
+    return p->total_size;
+  if((v = findvma(p, addr)) != 0)
+    return v->end;
+  return 0;
+}
+
+// Is [start, end) above p's heap and clear of its mappings?
+static int
+isfree(struct proc *p, uint start, uint end)
+{
+  struct vma *v;
+
+  if(start < PGROUNDUP(p->total_size) || start >= end)
+    return 0;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->end != 0 && start < v->end && end > v->start)
+      return 0;
+  return 1;
+}
+
+// Find room for a mapping of len bytes, a multiple of PGSIZE, in
+// p's address space: the highest gap that fits, right below KERNBASE
+// or another mapping. Returns a vma of p covering it, for the caller
+// to fill in, or 0 if there is none.
+struct vma*
+vmaalloc(struct proc *p, uint len)
+{
+  struct vma *v, *free;
+  uint start;
+
+  free = 0;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->end == 0 && free == 0)
+      free = v;
+  if(free == 0 || len == 0 || len >= KERNBASE)
+    return 0;
+
+  start = 0;
+  if(isfree(p, KERNBASE - len, KERNBASE))
+    start = KERNBASE - len;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->end != 0 && v->start >= len && v->start - len > start && isfree(p, v->start - len, v->start))
+      start = v->start - len;
+  if(start == 0)
+    return 0;
+
+  memset(free, 0, sizeof(*free));
+  free->start = start;
+  free->end = start + len;
+  return free;
+}
+
+// Map len bytes of f from offset off, or zeroed memory if f is 0,
+// into the current process. Returns the address, or -1.
+int
+mmap(uint len, int prot, int flags, struct file *f, uint off)
+{
+  struct vma *v;
+
+  if(off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 || (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if(flags & MAP_ANON){
+    // Anonymous memory is only private
+    if(f != 0 || (flags & MAP_SHARED))
+      return -1;
+  } else {
+    if(f == 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  if((v = vmaalloc(myproc(), PGROUNDUP(len))) == 0)
+    return -1;
+  v->prot = prot;
+  v->flags = flags;
+  v->file = f ? filedup(f) : 0;
+  v->off = off;
+  return v->start;
+}
+
+// If v is a shared file mapping of p, write its dirty pages in
+// [start, end) back to the file.
+void
+mmapsync(struct proc *p, struct vma *v, uint start, uint end)
+{
+  pte_t *pte;
+  uint a, size, foff;
+
+  if(v->file == 0 || !(v->flags & MAP_SHARED))
+    return;
+  ilock(v->file->ip);
+  size = v->file->ip->size;
+  iunlock(v->file->ip);
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    // Only what the file already holds; a mapping doesn't grow it
+    foff = v->off + (a - v->start);
+    if(foff < size)
+      filewriteat(v->file, (char*)a, min(PGSIZE, size - foff), foff);
+  }
+}
+
+// Unmap [start, end) of p's mapping v, writing the dirty pages of
+// a shared file mapping back to the file first. A shared memory
+// segment is only unmapped whole.
+static void
+unmap(struct proc *p, struct vma *v, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+
+  mmapsync(p, v, start, end);
+  for(a = start; a < end; a += PGSIZE){
+    // Segment frames belong to the segment, see shm.c
+    if((pte = walkpgdir(p->pgdir, (char*)a, 0)) && (*pte & PTE_P) && !zeromapped(pte) && v->shm == 0)
+      p->ram_size -= PGSIZE;
+  }
+  deallocuvm(p->pgdir, end, start);
+  pages_freed(p, start, end);
+  forget_range(p, start, end);
+
+  if(start == v->start && end == v->end){
+    if(v->file)
+      fileclose(v->file);
+    if(v->shm)
+      shmput(v->shm);
+    memset(v, 0, sizeof(*v));
+  } else if(start == v->start){
+    v->off += end - start;
+    v->start = end;
+  } else {
+    v->end = start;
+  }
+}
+
+// Unmap the pages of [addr, addr+len) from the current process.
+// The range has to be all or the start or the end of one mapping.
+// Returns 0, or -1 if it isn't.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint end;
+
+  end = PGROUNDUP(addr + len);
+  if(addr % PGSIZE != 0 || len == 0 || end < addr || (v = findvma(p, addr)) == 0)
+    return -1;
+  if(end > v->end || (addr != v->start && end != v->end))
+    return -1;
+  if(v->shm && (addr != v->start || end != v->end))
+    return -1;
+  p->paging++;
+  unmap(p, v, addr, end);
+  lcr3(V2P(p->pgdir));
+  p->paging--;
+  return 0;
+}
+
+// Unmap all of the current process's mappings, when it exits or
+// execs.
+void
+unmapall(void)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  p->paging++;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->end != 0)
+      unmap(p, v, v->start, v->end);
+  lcr3(V2P(p->pgdir));
+  p->paging--;
+}
+
+// Share the pages of p's mappings with page table d of a child
+// being forked, as copyuvm() does. Returns 0, or -1 if out of memory.
+int
+copymaps(pde_t *d, struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->end == 0)
+      continue;
+    // Shared memory stays shared, not copy-on-write
+    if(v->shm){
+      if(shmmap(d, v->shm, v->start) < 0)
+        return -1;
+    } else if(copyrange(p->pgdir, d, v->start, v->end, v->file && (v->flags & MAP_SHARED)) < 0){
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Give np the mappings of p, whose pages copymaps() shared.
+void
+dupmaps(struct proc *np, struct proc *p)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    np->vmas[i] = p->vmas[i];
+    if(np->vmas[i].file)
+      filedup(np->vmas[i].file);
+    if(np->vmas[i].shm)
+      shmdup(np->vmas[i].shm);
+  }
+}
+
+// Give page, in one of p's mappings but never touched yet, a frame:
+// read from the file, or zeroed. Like the heap, a page of a writable
+// anonymous mapping that is only read maps the zero page. Returns 0
+// if page isn't mapped or write isn't allowed, when out of memory,
+// or if the file can't be read.
+int
+mmapfault(struct proc *p, char *page, int write)
+{
+  struct vma *v;
+  struct segment seg;
+  struct inode *ip;
+  int nseg, locked, r;
+
+  // Segment pages are all mapped when it is attached
+  if((v = findvma(p, (uint)page)) == 0 || v->shm)
+    return 0;
+  if(write && !(v->prot & PROT_WRITE))
+    return 0;
+  if(v->file == 0 && !write && (v->prot & PROT_WRITE))
+    return mapzero(p->pgdir, page) == 0;
+
+  make_room(1);
+  ip = 0;
+  nseg = locked = 0;
+  if(v->file){
+    ip = v->file->ip;
+    // A system call reading or writing the file may be the one faulting
+    if(!holdingsleep(&ip->lock)){
+      ilock(ip);
+      locked = 1;
+    }
+    seg.vaddr = v->start;
+    seg.off = v->off;
+    seg.filesz = ip->size > v->off ? ip->size - v->off : 0;
+    nseg = 1;
+  }
+  r = loadpage(p->pgdir, ip, &seg, nseg, page, PTE_U | (v->prot & PROT_WRITE ? PTE_W : 0));
+  if(locked)
+    iunlock(ip);
+  if(r < 0)
+    return 0;
+  p->ram_size += PGSIZE;
+  if(!(v->flags & MAP_SHARED))
+    add_resident_page(p, page, 0);
+  return 1;
+}
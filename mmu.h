@@ -132,6 +132,9 @@ struct segdesc {
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define LPGSIZE         (PGSIZE*NPTENTRIES)  // bytes mapped by a large (PTE_PS) page
+#define LPGROUNDDOWN(a) (((a)) & ~(LPGSIZE-1))
+
 // Page table/directory entry flags.
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
@@ -144,12 +147,19 @@ struct segdesc {
 #define PTE_MBZ         0x180   // Bits must be zero
 #define PTE_PMALLOCED   0x800   // page was malloced using pmalloc (turning on the 12'th bit)
 #define PTE_PG 0x200 // Paged out to secondary storage
-#define PTE_WAS_PROTECTED 0x400
+#define PTE_COW 0x400 // Writable, but frame is shared with another process until first write
+
+// Page fault error code bits
+#define FEC_WR          0x002   // Caused by a write
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
 
+// A PTE_PG entry has no frame; its address bits hold the swap slot instead
+#define PTE_SLOT(pte)   ((uint)(pte) >> PTXSHIFT)
+#define SLOT_PTE(slot)  ((uint)(slot) << PTXSHIFT)
+
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
 
@@ -1,6 +1,11 @@
 #include "param.h"
 #include "types.h"
 #include "user.h"
+#include "policy.h"
+#include "fcntl.h"
+#include "mman.h"
+#include "memstats.h"
+#include "mmu.h"
 
 #define PGSIZE 4096
 
@@ -121,10 +126,656 @@ void test_fork() {
     printf(1, "Fork test PASSED\n");
 }
 
+/**
+ * parent and child share pages after fork; a write by one of them must not be seen by the other
+ */
+void test_cow() {
+    printf(1, "copy-on-write test\n");
+    char *mem = malloc(4 * PGSIZE);
+
+    memset(mem, 1, 4 * PGSIZE);
+
+    if (fork() == 0) {
+        memset(mem, 2, 2 * PGSIZE);
+        if (mem[0] != 2 || mem[3 * PGSIZE] != 1) {
+            printf(1, "child doesn't see its own writes! FAIL\n");
+            freeze();
+        }
+        exit();
+    }
+    wait();
+
+    for (int i = 0; i < 4 * PGSIZE; i += PGSIZE) {
+        if (mem[i] != 1) {
+            printf(1, "child write leaked to the parent! FAIL\n");
+            freeze();
+        }
+    }
+    free(mem);
+    printf(1, "Copy-on-write test PASSED\n");
+}
+
+/**
+ * scan a heap bigger than the resident set twice, so the second pass pages in with readahead
+ */
+void test_sequential_scan() {
+    printf(1, "sequential scan test\n");
+    if (fork()) {
+        wait();
+    } else {
+        // Far past the resident limit, so nearly every page is paged back in
+        int npages = 8 * RAMLIMIT;
+        struct memstats before, after;
+
+        set_policy(POLICY_SCFIFO, 0);
+        set_ram_limit(RAMLIMIT);
+        char *mem = malloc(npages * PGSIZE);
+        for (int i = 0; i < npages; ++i)
+            memset(mem + i * PGSIZE, i, PGSIZE);
+        getmemstats(0, &before);
+        for (int i = 0; i < npages; ++i) {
+            if (mem[i * PGSIZE] != (char) i || mem[i * PGSIZE + PGSIZE - 1] != (char) i) {
+                printf(1, "page %d corrupted after paging in! FAIL\n", i);
+                freeze();
+            }
+        }
+        getmemstats(0, &after);
+
+        // Readahead pages in more than one page per fault
+        int faults = after.major_faults - before.major_faults;
+        int pages_in = after.pages_in - before.pages_in;
+        if (pages_in < npages / 2 || faults >= pages_in) {
+            printf(1, "%d pages in with %d faults, no readahead! FAIL\n", pages_in, faults);
+            freeze();
+        }
+        free(mem);
+        exit();
+    }
+    printf(1, "Sequential scan test PASSED\n");
+}
+
+/**
+ * grow well past the old 32 page cap, then shrink the resident limit so most of it is paged out
+ */
+void test_ram_limit() {
+    printf(1, "resident limit test\n");
+    if (fork()) {
+        wait();
+    } else {
+        int npages = 64;
+        char *mem = sbrk(npages * PGSIZE);
+
+        if (mem == (char *) -1) {
+            printf(1, "sbrk of %d pages failed! FAIL\n", npages);
+            freeze();
+        }
+        for (int i = 0; i < npages; ++i)
+            mem[i * PGSIZE] = i;
+        if (set_ram_limit(4) < 0) {
+            printf(1, "set_ram_limit failed! FAIL\n");
+            freeze();
+        }
+        for (int i = npages - 1; i >= 0; --i) {
+            if (mem[i * PGSIZE] != i) {
+                printf(1, "page %d corrupted! FAIL\n", i);
+                freeze();
+            }
+        }
+        exit();
+    }
+    printf(1, "Resident limit test PASSED\n");
+}
+
+/**
+ * cycle pages through swap, reading only, then writing: a write after paging in must not be lost
+ */
+void test_swap_cache() {
+    printf(1, "swap cache test\n");
+    if (fork()) {
+        wait();
+    } else {
+        int npages = 24;
+        char *mem = sbrk(npages * PGSIZE);
+
+        for (int i = 0; i < npages; ++i)
+            mem[i * PGSIZE] = i;
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int i = 0; i < npages; ++i) {
+                if (mem[i * PGSIZE] != i) {
+                    printf(1, "page %d corrupted after reading! FAIL\n", i);
+                    freeze();
+                }
+            }
+        }
+        for (int i = 0; i < npages; ++i)
+            mem[i * PGSIZE] = i + 1;
+        for (int i = 0; i < npages; ++i) {
+            if (mem[i * PGSIZE] != i + 1) {
+                printf(1, "write to page %d lost! FAIL\n", i);
+                freeze();
+            }
+        }
+        exit();
+    }
+    printf(1, "Swap cache test PASSED\n");
+}
+
+/**
+ * run the same workload, over the resident limit, under every replacement policy
+ */
+void test_policies() {
+    printf(1, "policies test\n");
+    for (int policy = POLICY_NONE; policy <= POLICY_LAPA; ++policy) {
+        if (fork()) {
+            wait();
+            continue;
+        }
+        int npages = 12;
+        char *mem = sbrk(npages * PGSIZE);
+
+        if (set_policy(policy, 0) < 0 || set_ram_limit(4) < 0) {
+            printf(1, "can't select policy %d! FAIL\n", policy);
+            freeze();
+        }
+        for (int pass = 0; pass < 3; ++pass) {
+            for (int i = 0; i < npages; ++i)
+                mem[i * PGSIZE] = i + pass;
+            for (int i = 0; i < npages; ++i) {
+                if (mem[i * PGSIZE] != i + pass) {
+                    printf(1, "page %d corrupted under policy %d! FAIL\n", i, policy);
+                    freeze();
+                }
+            }
+        }
+        exit();
+    }
+    if (set_policy(POLICY_LAPA + 1, 0) == 0)
+        printf(1, "accepted a policy that doesn't exist! FAIL\n");
+    printf(1, "Policies test PASSED\n");
+}
+
+#ifdef GLOBAL
+// With global replacement a process that keeps faulting takes the
+// frames of one that sleeps, which gets its pages back intact later.
+void test_global() {
+    int npages = 64, ready[2], wake[2];
+    struct memstats before, after;
+    char c;
+
+    printf(1, "global replacement test\n");
+    pipe(ready);
+    pipe(wake);
+    int idle = fork();
+    if (idle == 0) {
+        set_policy(POLICY_SCFIFO, 0);
+        char *mem = sbrk(npages * PGSIZE);
+        for (int i = 0; i < npages; ++i)
+            mem[i * PGSIZE] = i;
+        write(ready[1], "r", 1);
+        read(wake[0], &c, 1);
+        for (int i = 0; i < npages; ++i) {
+            if (mem[i * PGSIZE] != (char) i) {
+                printf(1, "robbed page %d corrupted! FAIL\n", i);
+                freeze();
+            }
+        }
+        exit();
+    }
+    read(ready[0], &c, 1);
+    getmemstats(idle, &before);
+    if (fork() == 0) {
+        // Far more than all the resident limits together
+        int nbusy = 1024;
+        set_policy(POLICY_SCFIFO, 0);
+        char *mem = sbrk(nbusy * PGSIZE);
+        for (int pass = 0; pass < 2; ++pass)
+            for (int i = 0; i < nbusy; ++i)
+                mem[i * PGSIZE] = i + pass;
+        exit();
+    }
+    wait();
+    getmemstats(idle, &after);
+    if (after.resident_pages >= before.resident_pages || after.swapped_pages == 0) {
+        printf(1, "sleeping process kept %d of %d pages! FAIL\n", after.resident_pages,
+               before.resident_pages);
+        freeze();
+    }
+    write(wake[1], "w", 1);
+    wait();
+    close(ready[0]);
+    close(ready[1]);
+    close(wake[0]);
+    close(wake[1]);
+    printf(1, "Global replacement test PASSED\n");
+}
+#endif
+
+void test_sparse_sbrk() {
+    printf(1, "sparse sbrk test\n");
+    if (fork()) {
+        wait();
+    } else {
+        // Far more than RAM limit plus swap: only touched pages get frames
+        int npages = 16 * 1024;
+        char *mem = sbrk(npages * PGSIZE);
+
+        if (mem == (char *) -1) {
+            printf(1, "sbrk of %d pages failed! FAIL\n", npages);
+            freeze();
+        }
+        for (int i = 0; i < npages; i += 1024)
+            mem[i * PGSIZE] = i / 1024 + 1;
+        if (fork()) {
+            wait();
+        } else {
+            for (int i = 0; i < npages; i += 1024) {
+                if (mem[i * PGSIZE] != i / 1024 + 1 || mem[i * PGSIZE + PGSIZE / 2] != 0) {
+                    printf(1, "page %d wrong in child! FAIL\n", i);
+                    freeze();
+                }
+            }
+            exit();
+        }
+        for (int i = 512; i < npages; i += 1024) {
+            if (mem[i * PGSIZE] != 0) {
+                printf(1, "untouched page %d not zero! FAIL\n", i);
+                freeze();
+            }
+        }
+
+        // A pipe fills a page never touched, paged in before its lock is taken
+        int fds[2];
+        char *buf = mem + (npages - 1) * PGSIZE;
+        pipe(fds);
+        write(fds[1], "sbrk", 5);
+        if (read(fds[0], buf, 5) != 5 || strcmp(buf, "sbrk") != 0) {
+            printf(1, "pipe read into untouched page failed! FAIL\n");
+            freeze();
+        }
+        exit();
+    }
+    printf(1, "Sparse sbrk test PASSED\n");
+}
+
+void test_zero_page() {
+    printf(1, "zero page test\n");
+    if (fork()) {
+        wait();
+    } else {
+        // Reading pages never written takes neither RAM nor swap
+        int npages = 16 * 1024;
+        char *mem = sbrk(npages * PGSIZE);
+
+        for (int i = 0; i < npages; ++i) {
+            if (mem[i * PGSIZE + i % PGSIZE] != 0) {
+                printf(1, "page %d not zero! FAIL\n", i);
+                freeze();
+            }
+        }
+        for (int i = 0; i < npages; i += 512)
+            mem[i * PGSIZE] = 1;
+        for (int i = 0; i < npages; ++i) {
+            if (mem[i * PGSIZE] != (i % 512 == 0) || mem[i * PGSIZE + 1] != 0) {
+                printf(1, "page %d wrong after writes! FAIL\n", i);
+                freeze();
+            }
+        }
+        exit();
+    }
+    printf(1, "Zero page test PASSED\n");
+}
+
+void test_large_pages() {
+    printf(1, "large pages test\n");
+    if (fork()) {
+        wait();
+    } else {
+        int npages = 2 * 1024;
+        uint brk = (uint) sbrk(0);
+
+        set_large_pages(1);
+        set_ram_limit(4096);
+        // Two whole large pages
+        sbrk(((brk + 0x3FFFFF) & ~0x3FFFFF) - brk);
+        int *mem = (int *) sbrk(npages * PGSIZE);
+        for (int i = 0; i < npages; ++i)
+            mem[i * PGSIZE / sizeof(int)] = i;
+
+        // One fault maps a whole large page
+        struct memstats st;
+        if (getmemstats(0, &st) < 0 || st.minor_faults + st.major_faults > 64) {
+            printf(1, "%d faults for %d pages, no large pages! FAIL\n",
+                   st.minor_faults + st.major_faults, npages);
+            freeze();
+        }
+
+        // Paging out splits them
+        set_ram_limit(64);
+        for (int i = 0; i < npages; ++i) {
+            if (mem[i * PGSIZE / sizeof(int)] != i) {
+                printf(1, "page %d corrupted after split! FAIL\n", i);
+                freeze();
+            }
+        }
+        exit();
+    }
+    printf(1, "Large pages test PASSED\n");
+}
+
+void test_mmap() {
+    printf(1, "mmap test\n");
+    if (fork()) {
+        wait();
+    } else {
+        int npages = 64;
+
+        // Anonymous memory, paged out and in like the heap
+        set_ram_limit(16);
+        char *mem = mmap(0, npages * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (mem == (char *) -1) {
+            printf(1, "anonymous mmap failed! FAIL\n");
+            freeze();
+        }
+        for (int i = 0; i < npages; ++i)
+            mem[i * PGSIZE] = i;
+        for (int i = 0; i < npages; ++i) {
+            if (mem[i * PGSIZE] != (char) i || mem[i * PGSIZE + 1] != 0) {
+                printf(1, "mapped page %d corrupted! FAIL\n", i);
+                freeze();
+            }
+        }
+        if (munmap(mem, npages * PGSIZE) < 0) {
+            printf(1, "munmap failed! FAIL\n");
+            freeze();
+        }
+
+        // Writes to a shared file mapping reach the file at munmap()
+        char buf[PGSIZE];
+        int fd = open("mmaptest", O_CREATE | O_RDWR);
+        memset(buf, 'a', PGSIZE);
+        for (int i = 0; i < 4; ++i)
+            write(fd, buf, PGSIZE);
+        char *file = mmap(0, 4 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (file == (char *) -1 || file[3 * PGSIZE] != 'a') {
+            printf(1, "file mmap failed! FAIL\n");
+            freeze();
+        }
+        file[2 * PGSIZE + 1] = 'b';
+        munmap(file, 4 * PGSIZE);
+        close(fd);
+        fd = open("mmaptest", O_RDONLY);
+        read(fd, buf, PGSIZE);
+        read(fd, buf, PGSIZE);
+        read(fd, buf, PGSIZE);
+
+        // The kernel doesn't write into a read-only mapping for read()
+        char *ro = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ro == (char *) -1 || read(fd, ro, 1) != -1) {
+            printf(1, "read into read-only mapping! FAIL\n");
+            freeze();
+        }
+        munmap(ro, PGSIZE);
+        close(fd);
+
+        // write() and read() with a buffer mapping the same file, not
+        // loaded yet: the page is read in before the file's blocks are locked
+        fd = open("mmaptest", O_RDWR);
+        char *self = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (self == (char *) -1 || write(fd, self, 512) != 512) {
+            printf(1, "write from mapping of the same file failed! FAIL\n");
+            freeze();
+        }
+        munmap(self, PGSIZE);
+        self = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (self == (char *) -1 || read(fd, self, 512) != 512 || self[0] != 'a') {
+            printf(1, "read into mapping of the same file failed! FAIL\n");
+            freeze();
+        }
+        munmap(self, PGSIZE);
+        close(fd);
+        unlink("mmaptest");
+        if (buf[0] != 'a' || buf[1] != 'b') {
+            printf(1, "mapped file not written back! FAIL\n");
+            freeze();
+        }
+        exit();
+    }
+    printf(1, "mmap test PASSED\n");
+}
+
+void test_shm() {
+    printf(1, "shared memory test\n");
+    int npages = 32;
+    int id = shmget(0, npages * PGSIZE);
+    int *shared = shmat(id);
+
+    if (id < 0 || shared == (int *) -1) {
+        printf(1, "shmget/shmat failed! FAIL\n");
+        freeze();
+    }
+    if (fork()) {
+        wait();
+    } else {
+        // Same frames as the parent, never paged out
+        set_ram_limit(4);
+        for (int i = 0; i < npages; ++i)
+            shared[i * PGSIZE / sizeof(int)] = i + 1;
+        exit();
+    }
+    for (int i = 0; i < npages; ++i) {
+        if (shared[i * PGSIZE / sizeof(int)] != i + 1) {
+            printf(1, "child's write to page %d not seen! FAIL\n", i);
+            freeze();
+        }
+    }
+    // A removed segment can't be attached again, but stays until detached
+    if (shmrm(id) < 0 || shmat(id) != (void *) -1 || shared[0] != 1) {
+        printf(1, "segment not removed! FAIL\n");
+        freeze();
+    }
+    if (shmdt(shared) < 0 || shmrm(id) == 0) {
+        printf(1, "segment not freed at last detach! FAIL\n");
+        freeze();
+    }
+
+    // Segments removed without ever being attached are freed too
+    for (int i = 0; i < NSHM + 1; ++i) {
+        if ((id = shmget(0, PGSIZE)) < 0 || shmrm(id) < 0) {
+            printf(1, "unattached segment %d not freed! FAIL\n", i);
+            freeze();
+        }
+    }
+    printf(1, "Shared memory test PASSED\n");
+}
+
+void test_madvise() {
+    printf(1, "madvise test\n");
+    if (fork()) {
+        wait();
+    } else {
+        int npages = 64;
+
+        set_ram_limit(16);
+        // madvise() takes whole pages
+        char *mem = sbrk((npages + 1) * PGSIZE);
+        mem = (char *) (((uint) mem + PGSIZE - 1) & ~(PGSIZE - 1));
+        for (int i = 0; i < npages; ++i)
+            mem[i * PGSIZE] = i + 1;
+
+        // The first pages were paged out long ago
+        if (madvise(mem, 8 * PGSIZE, MADV_WILLNEED) < 0) {
+            printf(1, "MADV_WILLNEED failed! FAIL\n");
+            freeze();
+        }
+        for (int i = 0; i < 8; ++i) {
+            if (mem[i * PGSIZE] != i + 1) {
+                printf(1, "page %d corrupted after prefetch! FAIL\n", i);
+                freeze();
+            }
+        }
+
+        // Dropped pages read back as zeros
+        madvise(mem + 8 * PGSIZE, 8 * PGSIZE, MADV_DONTNEED);
+        for (int i = 8; i < 16; ++i) {
+            if (mem[i * PGSIZE] != 0) {
+                printf(1, "page %d not dropped! FAIL\n", i);
+                freeze();
+            }
+        }
+
+        madvise(mem, npages * PGSIZE, MADV_SEQUENTIAL);
+        for (int i = 16; i < npages; ++i) {
+            if (mem[i * PGSIZE] != i + 1) {
+                printf(1, "page %d corrupted in sequential scan! FAIL\n", i);
+                freeze();
+            }
+        }
+        exit();
+    }
+    printf(1, "madvise test PASSED\n");
+}
+
+void test_mlock() {
+    printf(1, "mlock test\n");
+    if (fork()) {
+        wait();
+    } else {
+        // Room for more than the lock limit, so only the limit can fail
+        int npages = MLOCKLIMIT + 16;
+
+        set_policy(POLICY_SCFIFO, 0);
+        set_ram_limit(16);
+        char *mem = sbrk((npages + 1) * PGSIZE);
+        mem = (char *) (((uint) mem + PGSIZE - 1) & ~(PGSIZE - 1));
+        for (int i = 0; i < npages; ++i)
+            mem[i * PGSIZE] = i + 1;
+        if (mlock(mem, 4 * PGSIZE) < 0 || mlock(mem, (MLOCKLIMIT + 1) * PGSIZE) == 0) {
+            printf(1, "lock limit not kept! FAIL\n");
+            freeze();
+        }
+
+        // Scanning the rest pages out everything but the locked pages
+        for (int round = 0; round < 2; ++round)
+            for (int i = 4; i < npages; ++i)
+                mem[i * PGSIZE]++;
+        for (int i = 0; i < 4; ++i) {
+            if (check_page_flags(mem + i * PGSIZE, PTE_PG) != 0) {
+                printf(1, "locked page %d paged out! FAIL\n", i);
+                freeze();
+            }
+        }
+        for (int i = 0; i < npages; ++i) {
+            if (mem[i * PGSIZE] != i + 1 + (i < 4 ? 0 : 2)) {
+                printf(1, "page %d corrupted! FAIL\n", i);
+                freeze();
+            }
+        }
+        if (munlock(mem, 4 * PGSIZE) < 0) {
+            printf(1, "munlock failed! FAIL\n");
+            freeze();
+        }
+        exit();
+    }
+    printf(1, "mlock test PASSED\n");
+}
+
+void test_memstats() {
+    struct memstats st;
+
+    printf(1, "memstats test\n");
+    if (fork()) {
+        wait();
+    } else {
+        int npages = 32;
+
+        set_policy(POLICY_SCFIFO, 0);
+        set_ram_limit(8);
+        char *mem = sbrk(npages * PGSIZE);
+        for (int round = 0; round < 2; ++round)
+            for (int i = 0; i < npages; ++i)
+                mem[i * PGSIZE] = i;
+        if (getmemstats(0, &st) < 0 || st.minor_faults == 0 || st.major_faults == 0 ||
+            st.pages_in == 0 || st.pages_out == 0 || st.swapped_pages == 0 ||
+            st.resident_pages == 0 || st.fault_cycles == 0) {
+            printf(1, "paging not counted! FAIL\n");
+            freeze();
+        }
+        printf(1, "%d minor, %d major faults, %d in, %d out, %d bytes to swap\n",
+               st.minor_faults, st.major_faults, st.pages_in, st.pages_out, st.swap_bytes);
+        exit();
+    }
+    if (getmemstats(-1, &st) == 0) {
+        printf(1, "stats of no process! FAIL\n");
+        freeze();
+    }
+    printf(1, "memstats test PASSED\n");
+}
+
+/**
+ * time the same number of SCFIFO evictions with bigger and bigger resident limits;
+ * the time shouldn't grow with the limit
+ */
+void bench_scfifo() {
+    int limits[] = {16, 128, 1024};
+
+    printf(1, "SCFIFO eviction benchmark\n");
+    for (int l = 0; l < 3; ++l) {
+        if (fork()) {
+            wait();
+            continue;
+        }
+        int npages = limits[l] + 32;
+
+        set_policy(POLICY_SCFIFO, 0);
+        set_ram_limit(limits[l]);
+        char *mem = sbrk(npages * PGSIZE);
+        for (int i = 0; i < npages; ++i)
+            mem[i * PGSIZE] = i;
+
+        // The first pages are paged out by now; each fault on one pages
+        // it in and another one out
+        struct memstats before, after;
+        getmemstats(0, &before);
+        int start = uptime();
+        for (int i = 0; i < 64; ++i) {
+            if (mem[i * PGSIZE] != (char) i) {
+                printf(1, "page %d corrupted! FAIL\n", i);
+                freeze();
+            }
+        }
+        int ticks = uptime() - start;
+        getmemstats(0, &after);
+        int faults = after.major_faults - before.major_faults;
+        if (faults == 0) {
+            printf(1, "no faults to time! FAIL\n");
+            freeze();
+        }
+        printf(1, "resident limit %d: %d ticks for %d faults\n", limits[l], ticks, faults);
+        exit();
+    }
+}
+
 int main() {
     test_big_malloc();
     test_pmalloc();
     test_swap();
     test_fork();
+    test_cow();
+    test_sequential_scan();
+    test_ram_limit();
+    test_swap_cache();
+    test_policies();
+#ifdef GLOBAL
+    test_global();
+#endif
+    test_sparse_sbrk();
+    test_zero_page();
+    test_large_pages();
+    test_mmap();
+    test_shm();
+    test_madvise();
+    test_mlock();
+    test_memstats();
+    bench_scfifo();
     exit();
 }
\ No newline at end of file
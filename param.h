@@ -11,8 +11,23 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define SWAPSIZE     (NSWAPSLOT*8)  // size of swap area in blocks, a page is 8 blocks
 
 #define PGSIZE       4096
 
-#define MAX_PSYC_PAGES  16
-#define MAX_TOTAL_PAGES 32
\ No newline at end of file
+#define RAMLIMIT     16  // resident pages per process, until set_ram_limit()
+#define NSWAPSLOT    4096  // swapped out pages in the system
+#define SWAPCLUSTER  8  // max pages paged out or in with one disk command
+#define MAX_READAHEAD 4  // max pages paged in on one fault
+#define NLARGEPAGE   4  // 4MB pages kept back for large-page processes
+#define ZPOOLSIZE    (128*PGSIZE)  // bytes of RAM for compressed swap, a power of 2
+#define NELFSEG      4  // max loadable segments in an executable
+#define FAULTAROUND  4  // max pages read from the executable on one fault
+#define PAGEOUT_LOW  256  // free pages below which the page-out daemon wakes
+#define PAGEOUT_HIGH 512  // free pages it pages out up to
+#define NVMA         16  // memory mappings per process
+#define NSHM         16  // shared memory segments in the system
+#define NADVICE       8  // address ranges with madvise() advice per process
+#define NMLOCK        8  // address ranges locked with mlock() per process
+#define MLOCKLIMIT   64  // pages a process may lock with mlock()
+#define PINPAGES     32  // max pages of a buffer pinned at a time, bits in a uint
@@ -0,0 +1,6 @@
+// Page replacement policies, for set_policy()
+#define POLICY_NONE    0  // never page out
+#define POLICY_SCFIFO  1  // second chance FIFO
+#define POLICY_LIFO    2  // last in, first out
+#define POLICY_NFUA    3  // not frequently used, with aging
+#define POLICY_LAPA    4  // least accessed page, with aging
@@ -6,7 +6,12 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
-#include "stat.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+#include "memstats.h"
+#include "policy.h"
 
 struct {
     struct spinlock lock;
@@ -17,6 +22,23 @@ static struct proc *initproc;
 
 int nextpid = 1;
 
+// Replacement policy of init, inherited by the processes to come
+#ifdef SCFIFO
+int default_policy = POLICY_SCFIFO;
+#endif
+#ifdef LIFO
+int default_policy = POLICY_LIFO;
+#endif
+#ifdef NFUA
+int default_policy = POLICY_NFUA;
+#endif
+#ifdef LAPA
+int default_policy = POLICY_LAPA;
+#endif
+#ifdef NONE
+int default_policy = POLICY_NONE;
+#endif
+
 extern void forkret(void);
 
 extern void trapret(void);
@@ -91,10 +113,7 @@ allocproc(void) {
     p->pid = nextpid++;
 
     release(&ptable.lock);
-#ifndef NONE
-    if (p->pid > 2)
-        createSwapFile(p);
-#endif
+
     // Allocate kernel stack.
     if ((p->kstack = kalloc()) == 0) {
         p->state = UNUSED;
@@ -135,6 +154,9 @@ userinit(void) {
     inituvm(p->pgdir, _binary_initcode_start, (int) _binary_initcode_size);
     p->total_size = PGSIZE;
     p->ram_size = p->total_size;
+    p->ram_limit = RAMLIMIT;
+    p->mlock_limit = MLOCKLIMIT;
+    p->policy = default_policy;
     memset(p->tf, 0, sizeof(*p->tf));
     p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
     p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -158,189 +180,916 @@ userinit(void) {
     release(&ptable.lock);
 }
 
-char *get_page_to_swapLIFO() {
-    struct proc *p = myproc();
+// Page replacement policies.
+//
+// Each process has one, chosen at run time with set_policy(). The
+// policy keeps the process's resident set: it is told about every
+// page that is allocated or paged in, picks the victims for paging
+// out, and is told when pages are freed. The default one comes from
+// SELECTION at build time.
 
-    if (p->pages_on_ram_stack_pointer == 0)
-        panic("No pages to swap out");
+void push_page(struct proc *p, char *va) {
+    rspush(p, va);
+}
 
-    return p->pages_on_ram[(p->pages_on_ram_stack_pointer--) - 1];
+// For NFUA: the page was just used.
+void push_used_page(struct proc *p, char *va) {
+    rspush(p, va);
+    *rsage(p, p->num_pages_on_ram - 1) = 0x80000000;
 }
-uint get_swapped_page_offset(char *page) {
-    struct proc *p = myproc();
-    int i;
 
-    // iterate until you find a free space
-    for (i = 0; p->swapped_pages_entry[i] != 0; i++);
+// For LAPA: count the page as used in every tick until it shows otherwise.
+void push_unproven_page(struct proc *p, char *va) {
+    rspush(p, va);
+    *rsage(p, p->num_pages_on_ram - 1) = 0xFFFFFFFF;
+}
 
-    p->swapped_pages_entry[i] = page;
+void drop_pages(struct proc *p, uint start, uint end) {
+    rsdrop(p, start, end);
+}
 
-    return i * PGSIZE;
+// NONE never pages out.
+char *no_victim(struct proc *p) {
+    return 0;
 }
 
-char *get_page_to_swap_SCFIFO() {
-    struct proc *p = myproc();
-    uint i = 0;
+char *get_page_to_swapLIFO(struct proc *p) {
+    if (p->num_pages_on_ram == 0)
+        panic("No pages to swap out");
+
+    return rspop(p);
+}
+
+// The resident set is a circular queue, and its head is the clock hand.
+// Inserting at the tail, moving the hand and taking the page under it
+// all take constant time.
+char *get_page_to_swap_SCFIFO(struct proc *p) {
     pte_t *pte;
-    uint found = 0;
-    char *page = 0;
+    char *page;
     uint counter = 0;
 
-    while (!found) {
-        if (counter++ > MAX_TOTAL_PAGES)
+    for (;;) {
+        // Every page gets at most one second chance
+        if (counter++ > p->num_pages_on_ram)
             panic("No pages found to swap out");
 
-        // Get next page in the queue
-        page = p->pages_on_ram[i];
-
-        // If the entry in the queue is empty, continue
-        if (page == 0) {
-            i = (i + 1) % MAX_PSYC_PAGES;
-            continue;
-        }
+        // Get the page under the hand
+        page = rsget(p, 0);
 
         // Find the page's pte entry
         pte = walkpgdir(p->pgdir, page, 0);
 
-        // The page was accessed in the last time tick
+        // The page wasn't accessed since the hand last passed
+        if (!(*pte & PTE_A))
+            break;
+
+        // zero the accessed flag and give it a second chance; with its
+        // TLB entry gone the next access sets the flag again
+        *pte &= ~PTE_A;
+        invlpg(page);
+        rsrotate(p);
+    }
+
+    // Take it out of the queue
+    rsremove(p, 0);
+
+    return page;
+}
+
+// Number of set bits in x
+int count_ones(uint x) {
+    int n;
+
+    for (n = 0; x; x &= x - 1)
+        n++;
+    return n;
+}
+
+// The page with the lowest age: the least used over the last 32 ticks,
+// counting the recent ones most.
+char *get_page_to_swap_NFUA(struct proc *p) {
+    uint i, victim = 0;
+    char *page;
+
+    if (p->num_pages_on_ram == 0)
+        panic("No pages to swap out");
+
+    for (i = 1; i < p->num_pages_on_ram; ++i)
+        if (*rsage(p, i) < *rsage(p, victim))
+            victim = i;
+
+    page = rsget(p, victim);
+    rsremove(p, victim);
+    return page;
+}
+
+// The page used in the fewest of the last 32 ticks; of those,
+// the one with the lowest age.
+char *get_page_to_swap_LAPA(struct proc *p) {
+    uint i, victim = 0;
+    int ones, victim_ones;
+    char *page;
+
+    if (p->num_pages_on_ram == 0)
+        panic("No pages to swap out");
+
+    victim_ones = count_ones(*rsage(p, 0));
+    for (i = 1; i < p->num_pages_on_ram; ++i) {
+        ones = count_ones(*rsage(p, i));
+        if (ones < victim_ones || (ones == victim_ones && *rsage(p, i) < *rsage(p, victim))) {
+            victim = i;
+            victim_ones = ones;
+        }
+    }
+
+    page = rsget(p, victim);
+    rsremove(p, victim);
+    return page;
+}
+
+// For NFUA and LAPA, on every timer tick that interrupts the process in
+// user space: shift each resident page's age right, bringing its PTE_A
+// bit in at the top, and clear PTE_A.
+void age_pages(struct proc *p) {
+    pte_t *pte;
+    uint i, *age;
+
+    for (i = 0; i < p->num_pages_on_ram; ++i) {
+        age = rsage(p, i);
+        pte = walkpgdir(p->pgdir, rsget(p, i), 0);
+        *age >>= 1;
         if (*pte & PTE_A) {
-            // zero the accessed flag and give it a second chance
-            turn_off_page_flags(page, PTE_A);
-            i = (i + 1) % MAX_PSYC_PAGES;
+            *age |= 0x80000000;
+            *pte &= ~PTE_A;
+        }
+    }
+    // Or accesses through the TLB wouldn't set PTE_A again
+    lcr3(V2P(p->pgdir));
+}
+
+struct policy {
+    void (*on_alloc)(struct proc *p, char *va);     // va was just allocated
+    void (*on_fault_in)(struct proc *p, char *va);  // va was just paged in
+    char *(*pick_victim)(struct proc *p);           // take a page out of the resident set, or 0
+    void (*on_free)(struct proc *p, uint start, uint end);  // the pages in [start, end) were freed
+    void (*on_tick)(struct proc *p);                // a timer tick in user space, if wanted
+} policies[] = {
+[POLICY_NONE]   { push_page, push_page, no_victim, drop_pages, 0 },
+[POLICY_SCFIFO] { push_page, push_page, get_page_to_swap_SCFIFO, drop_pages, 0 },
+[POLICY_LIFO]   { push_page, push_page, get_page_to_swapLIFO, drop_pages, 0 },
+[POLICY_NFUA]   { push_used_page, push_used_page, get_page_to_swap_NFUA, drop_pages, age_pages },
+[POLICY_LAPA]   { push_unproven_page, push_unproven_page, get_page_to_swap_LAPA, drop_pages, age_pages },
+};
+
+// Return the value table r, with n entries, gives va, or 0.
+static int range_at(struct range *r, int n, char *va) {
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (r[i].end != 0 && (uint) va >= r[i].start && (uint) va < r[i].end)
+            return r[i].value;
+    return 0;
+}
+
+// Return the advice in effect at va of p: MADV_SEQUENTIAL,
+// MADV_RANDOM or MADV_NORMAL.
+static int advice_at(struct proc *p, char *va) {
+    return range_at(p->advice, NADVICE, va);
+}
+
+// Did mlock() lock va of p in RAM?
+static int mlocked(struct proc *p, char *va) {
+    return range_at(p->mlocks, NMLOCK, va);
+}
+
+// Take a victim out of p's resident set. Pages of MADV_SEQUENTIAL
+// ranges go first, oldest first, since a scan that passed them won't
+// be back; otherwise p's policy picks. Returns 0 if there is none.
+static char *pick_victim(struct proc *p) {
+    char *va;
+    uint i;
+    int j;
+
+    for (j = 0; j < NADVICE; j++)
+        if (p->advice[j].end != 0 && p->advice[j].value == MADV_SEQUENTIAL)
+            break;
+    if (j < NADVICE && p->policy != POLICY_NONE) {
+        for (i = 0; i < p->num_pages_on_ram; i++) {
+            if (advice_at(p, va = rsget(p, i)) == MADV_SEQUENTIAL) {
+                rsremove(p, i);
+                return va;
+            }
+        }
+    }
+    return policies[p->policy].pick_victim(p);
+}
+
+char *get_address_of_page_to_swap() {
+    return pick_victim(myproc());
+}
+
+// The pages of p in [start, end) were just unmapped.
+void pages_freed(struct proc *p, uint start, uint end) {
+    policies[p->policy].on_free(p, start, end);
+}
+
+// Called on every timer tick that interrupts the current process in user space.
+void policy_tick(void) {
+    struct proc *p = myproc();
+
+    if (policies[p->policy].on_tick)
+        policies[p->policy].on_tick(p);
+}
+
+
+// Page out num_pages victims (at most SWAPCLUSTER).
+// Victims not written to since they were paged in still have a good copy
+// in swap and are just dropped. The others go to adjacent swap slots with
+// a single disk write, or a few if swap has no long enough run.
+// Returns how many were paged out: fewer if swap is full.
+int write_to_swap_file(int num_pages) {
+    struct proc *p = myproc();
+    char *pages[SWAPCLUSTER], *frames[SWAPCLUSTER];
+    char *page, *frame;
+    pte_t *pte;
+    int slot, i, n, done, dirty, evicted;
+
+    dirty = evicted = 0;
+    for (i = 0; i < num_pages; i++) {
+        if ((page = get_address_of_page_to_swap()) == 0)
+            break;
+        pte = walkpgdir(p->pgdir, page, 0);
+        // The disk driver may touch the page from another address space
+        frame = P2V(PTE_ADDR(*pte));
+        if (!(*pte & PTE_D) && (slot = swapcachedup(frame)) >= 0) {
+            evict_frame(p->pgdir, page, slot);
+            evicted++;
         } else {
-            found = 1;
+            pages[dirty] = page;
+            frames[dirty++] = frame;
         }
     }
 
-    // Push back all the queue from i forward
-    for (; i < MAX_PSYC_PAGES - 1; ++i) {
-        p->pages_on_ram[i] = p->pages_on_ram[i + 1];
+    for (done = 0; done < dirty; done += n) {
+        n = dirty - done;
+        while ((slot = swapalloc(n)) < 0)
+            if ((n /= 2) == 0)
+                break;
+        if (n == 0) {
+            // Swap is full, the rest stay in RAM
+            for (i = done; i < dirty; i++)
+                rspush(p, pages[i]);
+            break;
+        }
+        swapwrite(slot, frames + done, n);
+        for (i = 0; i < n; i++)
+            evict_frame(p->pgdir, pages[done + i], slot + i);
+        evicted += n;
+        p->swap_bytes += n * PGSIZE;
     }
 
-    // Set the last item in the queue to 0 - free spot
-    p->pages_on_ram[15] = 0;
+    p->ram_size -= evicted * PGSIZE;
+    p->total_paged_out += evicted;
+    return evicted;
+}
 
-    return page;
+// May q's memory map be changed by the current process now? Another
+// process is only robbed of pages (by global replacement or the
+// page-out daemon) while it isn't running and isn't in the middle of
+// changing its own memory map (p->paging), so its page table,
+// resident set and ram_size can be changed under ptable.lock. It
+// isn't in any TLB then either.
+static int may_rob(struct proc *q) {
+    if (q == myproc())
+        return 1;
+    return (q->state == SLEEPING || q->state == RUNNABLE) && q->paging == 0;
 }
 
+#ifdef GLOBAL
+// Global replacement.
+//
+// The resident limits of all processes add up to one pool, and a
+// single clock hand sweeps the user frames of the whole system for
+// victims, whoever they belong to. The reverse map records which
+// process maps each frame put in a resident set, and where. A frame
+// shared since fork passes to whichever sharer keeps it; frames
+// still shared are skipped. Other processes are robbed as may_rob()
+// allows.
 
-char *get_address_of_page_to_swap() {
-#ifdef SCFIFO
-    return get_page_to_swap_SCFIFO();
+struct {
+    struct proc *proc;
+    char *va;
+} rmap[PHYSTOP >> PGSHIFT];  // under ptable.lock
+
+uint clock_hand;
+
+// Record that p maps the frame now at va.
+void rmap_add(struct proc *p, char *va) {
+    uint f = PTE_ADDR(*walkpgdir(p->pgdir, va, 0)) >> PGSHIFT;
+
+    acquire(&ptable.lock);
+    rmap[f].proc = p;
+    rmap[f].va = va;
+    release(&ptable.lock);
+}
+
+// Return q's PTE for va if it maps frame f there, else 0. Only the
+// page tables of processes that may be robbed are walked: the others
+// may be changing them right now.
+static pte_t *maps_frame(struct proc *q, uint f, char *va) {
+    pte_t *pte;
+
+    if (!may_rob(q))
+        return 0;
+    pte = walkpgdir(q->pgdir, va, 0);
+    if (pte && (*pte & (PTE_P | PTE_U)) == (PTE_P | PTE_U) && PTE_ADDR(*pte) == f << PGSHIFT)
+        return pte;
+    return 0;
+}
+
+// Find the PTE of the one user mapping of frame f, and its process.
+// Returns 0 if f isn't mapped, is still shared, or belongs to a
+// process that may not be robbed now.
+// Caller holds ptable.lock.
+static pte_t *rmap_lookup(uint f, struct proc **qp) {
+    struct proc *q;
+    pte_t *pte;
+    int busy;
+
+    if (rmap[f].proc == 0 || krefcount(P2V(f << PGSHIFT)) != 1 || !may_rob(rmap[f].proc))
+        return 0;
+    if ((pte = maps_frame(rmap[f].proc, f, rmap[f].va)) == 0) {
+        // Since fork, sharers map the frame at the same address
+        for (busy = 0, q = ptable.proc; q < &ptable.proc[NPROC]; q++) {
+            if ((pte = maps_frame(q, f, rmap[f].va)) != 0)
+                break;
+            busy |= q->state == RUNNING || q->paging > 0;
+        }
+        if (pte == 0) {
+            // Forget f unless a process that wasn't looked at may map it
+            if (!busy)
+                rmap[f].proc = 0;
+            return 0;
+        }
+        rmap[f].proc = q;
+    }
+    *qp = rmap[f].proc;
+    return pte;
+}
+
+// Advance the clock hand to a frame that may be paged out, giving
+// frames accessed since the hand last passed a second chance.
+// Returns its PTE, or 0 after two sweeps without one.
+// Caller holds ptable.lock.
+static pte_t *clock_next(struct proc **qp, char **vap) {
+    pte_t *pte;
+    uint n;
+
+    for (n = 0; n < 2 * NELEM(rmap); n++) {
+        clock_hand = (clock_hand + 1) % NELEM(rmap);
+        if ((pte = rmap_lookup(clock_hand, qp)) == 0)
+            continue;
+        if (*pte & PTE_A) {
+            *pte &= ~PTE_A;
+            if (*qp == myproc())
+                invlpg(rmap[clock_hand].va);
+            continue;
+        }
+        *vap = rmap[clock_hand].va;
+        return pte;
+    }
+    return 0;
+}
+
+// Page out up to num_pages (at most SWAPCLUSTER) pages chosen by the
+// clock among the resident pages of all processes. Clean pages are
+// dropped as in write_to_swap_file(), the others are written with
+// a single disk write. Returns how many were paged out.
+int write_to_swap_file_global(int num_pages) {
+    struct proc *q;
+    char *victims[SWAPCLUSTER], *frames[SWAPCLUSTER];
+    char *va, *frame;
+    pte_t *pte;
+    int slot, nslots, dirty, n, i, s;
+
+    // Slots for the pages to write, before knowing how many there are
+    slot = -1;
+    nslots = num_pages;
+    while (nslots > 0 && (slot = swapalloc(nslots)) < 0)
+        nslots /= 2;
+
+    // Page-ins of the victims have to wait for them to be written
+    swaplock();
+    acquire(&ptable.lock);
+    for (n = dirty = 0; n < num_pages && (pte = clock_next(&q, &va)) != 0;) {
+        if (rsdel(q, va) < 0)
+            continue;
+        frame = P2V(PTE_ADDR(*pte));
+        if ((*pte & PTE_D) || (s = swapcachedup(frame)) < 0) {
+            if (dirty == nslots) {
+                rspush(q, va);
+                break;
+            }
+            s = slot + dirty;
+            frames[dirty++] = frame;
+            q->swap_bytes += PGSIZE;
+        }
+        // Keep the frame until it's written
+        kincref(frame);
+        evict_frame(q->pgdir, va, s);
+        q->ram_size -= PGSIZE;
+        q->total_paged_out++;
+        victims[n++] = frame;
+    }
+    release(&ptable.lock);
+    if (dirty > 0)
+        swapwrite(slot, frames, dirty);
+    swapunlock();
+
+    for (i = dirty; i < nslots; i++)
+        swapfree(slot + i);
+    for (i = 0; i < n; i++)
+        kfree(victims[i]);
+    return n;
+}
 #endif
-#ifdef LIFO
-    return get_page_to_swapLIFO();
+
+#ifndef GLOBAL
+// For the page-out daemon: page out up to num_pages (at most
+// SWAPCLUSTER) pages of the process with the largest resident set
+// that may be robbed, as its policy picks them. Works like
+// write_to_swap_file_global(). Returns how many were paged out.
+static int steal_pages(int num_pages) {
+    struct proc *p, *q;
+    char *victims[SWAPCLUSTER], *frames[SWAPCLUSTER];
+    char *va, *frame;
+    pte_t *pte;
+    int slot, nslots, dirty, n, i, s;
+
+    slot = -1;
+    nslots = num_pages;
+    while (nslots > 0 && (slot = swapalloc(nslots)) < 0)
+        nslots /= 2;
+
+    swaplock();
+    acquire(&ptable.lock);
+    q = 0;
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if (p != myproc() && p->policy != POLICY_NONE && may_rob(p) &&
+            (q == 0 || p->num_pages_on_ram > q->num_pages_on_ram))
+            q = p;
+    for (n = dirty = 0; q && n < num_pages && q->num_pages_on_ram > 0;) {
+        if ((va = pick_victim(q)) == 0)
+            break;
+        if ((pte = walkpgdir(q->pgdir, va, 0)) == 0 || !(*pte & PTE_P))
+            continue;
+        frame = P2V(PTE_ADDR(*pte));
+        if ((*pte & PTE_D) || (s = swapcachedup(frame)) < 0) {
+            if (dirty == nslots) {
+                rspush(q, va);
+                break;
+            }
+            s = slot + dirty;
+            frames[dirty++] = frame;
+            q->swap_bytes += PGSIZE;
+        }
+        kincref(frame);
+        evict_frame(q->pgdir, va, s);
+        q->ram_size -= PGSIZE;
+        q->total_paged_out++;
+        victims[n++] = frame;
+    }
+    release(&ptable.lock);
+    if (dirty > 0)
+        swapwrite(slot, frames, dirty);
+    swapunlock();
+
+    for (i = dirty; i < nslots; i++)
+        swapfree(slot + i);
+    for (i = 0; i < n; i++)
+        kfree(victims[i]);
+    return n;
+}
 #endif
-#ifdef NONE
-    return 0;
+
+// The page-out daemon, a process that only runs in the kernel. On
+// every tick it checks how many pages are free, and once that drops
+// below PAGEOUT_LOW it pages out other processes' pages until
+// PAGEOUT_HIGH are free, so that allocations seldom find memory
+// short and seldom have to wait for pages to be written.
+static void pageoutd(void) {
+    int n;
+
+    for (;;) {
+        acquire(&tickslock);
+        sleep(&ticks, &tickslock);
+        release(&tickslock);
+        if (kfreecount() >= PAGEOUT_LOW)
+            continue;
+        do {
+#ifdef GLOBAL
+            n = write_to_swap_file_global(SWAPCLUSTER);
+#else
+            n = steal_pages(SWAPCLUSTER);
 #endif
+        } while (n > 0 && kfreecount() < PAGEOUT_HIGH);
+    }
 }
 
+// Start the page-out daemon.
+void pageoutinit(void) {
+    struct proc *p;
 
-void write_to_swap_file(char *page) {
-    struct proc *p = myproc();
+    if ((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+        panic("pageoutinit");
+    // forkret() returns into pageoutd() instead of trapret
+    *(uint *) (p->context + 1) = (uint) pageoutd;
+    safestrcpy(p->name, "pageoutd", sizeof(p->name));
 
-    writeToSwapFile(p, page, get_swapped_page_offset(page), PGSIZE);
-    light_page_flags(page, PTE_PG);
-    turn_off_page_flags(page, PTE_P);
+    acquire(&ptable.lock);
+    p->state = RUNNABLE;
+    release(&ptable.lock);
 }
 
-void swap_out_num_pages(int num_pages) {
-    if (num_pages <= 0) return;
+// Put page va, just allocated or paged in (fault_in), in p's resident
+// set, unless mlock() keeps it out of reach of the policy.
+void add_resident_page(struct proc *p, char *va, int fault_in) {
+    // Without memory for the entry the page just stays in RAM
+    if (mlocked(p, va) || rsreserve(p, p->num_pages_on_ram + 1) < 0)
+        return;
+    if (fault_in)
+        policies[p->policy].on_fault_in(p, va);
+    else
+        policies[p->policy].on_alloc(p, va);
+#ifdef GLOBAL
+    rmap_add(p, va);
+#endif
+}
 
-    struct proc *p = myproc();
+void swap_out_num_pages(int num_pages) {
+    int n;
 
-    for (int i = 0; i < num_pages; ++i) {
-        char *page = get_address_of_page_to_swap();
-        write_to_swap_file(page);
-        p->ram_size -= PGSIZE;
-        p->total_paged_out++;
+    while (num_pages > 0) {
+#ifdef GLOBAL
+        n = write_to_swap_file_global(min(num_pages, SWAPCLUSTER));
+#else
+        n = write_to_swap_file(min(num_pages, SWAPCLUSTER));
+#endif
+        if (n == 0)
+            break;
+        num_pages -= n;
     }
 }
 
-void restore_page_from_disk(char *page) {
+// How many more pages the current process may have resident: up to its
+// resident limit, or with GLOBAL, until all processes together reach
+// the sum of their limits.
+int ram_room(void) {
+#ifdef GLOBAL
+    struct proc *q;
+    int room = 0;
+
+    acquire(&ptable.lock);
+    for (q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+        if (q->state != UNUSED && q->state != EMBRYO)
+            room += q->ram_limit - q->ram_size / PGSIZE;
+    release(&ptable.lock);
+    return room;
+#else
     struct proc *p = myproc();
+
+    return p->ram_limit - p->ram_size / PGSIZE;
+#endif
+}
+
+// Split the large page of p around va, if there is one, and put its
+// pages in p's resident set, so they can be paged out or shared one
+// at a time. Returns 1 if it split one, 0 if there is none, or -1 if
+// out of memory.
+int split_large_page(struct proc *p, char *va) {
     uint i;
-    // get the index of the page at swapped_pages_entry
-    for (i = 0; p->swapped_pages_entry[i] != page && i < MAX_PSYC_PAGES; i++);
+    int r;
+
+    va = (char *) LPGROUNDDOWN((uint) va);
+    if ((r = splitlarge(p->pgdir, va)) <= 0)
+        return r;
+    for (i = 0; i < NPTENTRIES; i++)
+        add_resident_page(p, va + i * PGSIZE, 0);
+    return 1;
+}
+
+// Split one of p's large pages, as split_large_page() does.
+static int split_any_large_page(struct proc *p) {
+    uint i;
+
+    for (i = 0; i < PDX(KERNBASE); i++)
+        if (p->pgdir[i] & PTE_PS)
+            return split_large_page(p, (char *) PGADDR(i, 0, 0));
+    return 0;
+}
+
+// Page out pages until npages more fit within the resident limit.
+// When swap is full it stays over the limit instead.
+void make_room(uint npages) {
+    struct proc *p = myproc();
+    int over = npages - ram_room();
+
+    // Large pages are only paged out once split
+    while (over > (int) p->num_pages_on_ram && split_any_large_page(p) > 0)
+        ;
 
-    if (i >= MAX_PSYC_PAGES)
-        panic("Couldn't find page in the swap file");
+#ifdef GLOBAL
+    swap_out_num_pages(over);
+#else
+    swap_out_num_pages(min(over, p->num_pages_on_ram));
+#endif
+}
 
-    if (!check_page_flags(page, PTE_W)) {
-        light_page_flags(page, PTE_W | PTE_WAS_PROTECTED);
+// How many pages to read in for a fault on page, counting page itself.
+// A process that keeps faulting at the same stride (e.g. scanning an
+// array) gets a readahead window that doubles with every fault that
+// fits the pattern, and falls back to a single page when one doesn't.
+// madvise() advice overrides the guess.
+uint readahead_window(struct proc *p, char *page) {
+    switch (advice_at(p, page)) {
+    case MADV_SEQUENTIAL:
+        p->fault_stride = PGSIZE;
+        p->readahead = MAX_READAHEAD;
+        return p->readahead;
+    case MADV_RANDOM:
+        p->fault_stride = 0;
+        p->readahead = 1;
+        return p->readahead;
     }
-    readFromSwapFile(p, page, i * PGSIZE, PGSIZE);
-    if (check_page_flags(page, PTE_WAS_PROTECTED)) {
-        turn_off_page_flags(page, PTE_W | PTE_WAS_PROTECTED);
+    if (p->fault_stride != 0 && page == p->last_fault + p->fault_stride) {
+        p->readahead = min(p->readahead * 2, MAX_READAHEAD);
+    } else {
+        p->fault_stride = page - p->last_fault;
+        p->readahead = 1;
     }
-    p->swapped_pages_entry[i] = 0;
+    return p->readahead;
 }
 
-uint page_fault_handler() {
+// Page in the n pages pages[], with PTEs ptes[], which were paged out
+// to adjacent swap slots, with one disk read. Returns how many it
+// paged in: fewer, or 0, when out of memory.
+static int swap_in(char **pages, pte_t **ptes, int n) {
+    char *mems[SWAPCLUSTER];
+    int i, slot = PTE_SLOT(*ptes[0]);
+
+    for (i = 0; i < n; i++)
+        if ((mems[i] = kalloc()) == 0)
+            break;
+    if ((n = i) == 0)
+        return 0;
+
+    // Our references to the slots go to the swap cache, so a page that
+    // stays clean can be paged out again without writing it.
+    swapread(slot, mems, n);
+    for (i = 0; i < n; i++) {
+        swapcacheadd(mems[i], slot + i);
+        map_swapped_in(ptes[i], pages[i], mems[i]);
+    }
+    myproc()->pages_in += n;
+    return n;
+}
+
+// Page in page, whose PTE is pte, plus the pages that follow it along
+// the fault stride as long as they sit in the swap slots right after
+// it, all with one disk read. Fills pages[] with what was paged in,
+// and returns how many (0 when out of memory).
+int restore_page_from_disk(char *page, pte_t *pte, char **pages) {
     struct proc *p = myproc();
+    pte_t *ptes[SWAPCLUSTER];
+    int n, window, slot;
+
+    if (!(*pte & PTE_PG))
+        panic("restore_page_from_disk: page not paged out");
+    slot = PTE_SLOT(*pte);
+    pages[0] = page;
+    ptes[0] = pte;
+
+    window = readahead_window(p, page);
+    for (n = 1; n < window; n++) {
+        pages[n] = page + n * p->fault_stride;
+        if ((uint) pages[n] >= userend(p, (uint) page))
+            break;
+        ptes[n] = walkpgdir(p->pgdir, pages[n], 0);
+        if (ptes[n] == 0 || !(*ptes[n] & PTE_PG) || PTE_SLOT(*ptes[n]) != slot + n)
+            break;
+    }
+
+    if ((n = swap_in(pages, ptes, n)) > 0)
+        p->last_fault = pages[n - 1];
+    return n;
+}
+
+// Is page one that p's executable fills in, and not mapped yet?
+static int unloaded_exe_page(struct proc *p, char *page) {
     pte_t *pte;
-    p->page_faults++;
+    int i;
+
+    if (p->exe == 0 || (uint) page >= p->total_size)
+        return 0;
+    if ((pte = walkpgdir(p->pgdir, page, 0)) != 0 && (*pte & (PTE_P | PTE_PG)))
+        return 0;
+    for (i = 0; i < p->nseg; i++)
+        if ((uint) page < p->segs[i].vaddr + p->segs[i].filesz && (uint) page + PGSIZE > p->segs[i].vaddr)
+            return 1;
+    return 0;
+}
+
+// May the large page around page be mapped for p: is all of it
+// below the break, with nothing mapped there and no part of the
+// program image, and is there room for it?
+static int large_page_fits(struct proc *p, char *page) {
+    uint start = LPGROUNDDOWN((uint) page);
+    int i;
+
+    if (!p->large_pages || start + LPGSIZE > p->total_size || p->pgdir[PDX(start)] != 0)
+        return 0;
+    for (i = 0; i < p->nseg; i++)
+        if (start < p->segs[i].vaddr + p->segs[i].filesz && start + LPGSIZE > p->segs[i].vaddr)
+            return 0;
+    return ram_room() >= NPTENTRIES;
+}
 
-    // The address that caused the page fault in the first place, and it's page
-    uint addr = rcr2();
+// Give page, below the break but never touched yet, a frame: read
+// from the executable if an ELF segment puts file contents there,
+// zeroed otherwise (e.g. heap that sbrk() reserved). Programs run on
+// into the code and data around what they touch, so the missing
+// executable pages of the FAULTAROUND-page block around page are
+// read in with it, unless madvise() said MADV_RANDOM. A page of
+// zeros that is only read (write == 0) maps the zero page instead,
+// until its first write. With large pages on, a whole large page is
+// mapped where one fits. Returns 0 when out of memory or the
+// executable can't be read.
+int map_new_page(struct proc *p, char *page, int write) {
+    char *pages[FAULTAROUND], *start, *end, *va;
+    int n, i, locked;
+
+    if (large_page_fits(p, page) && maplarge(p->pgdir, (char *) LPGROUNDDOWN((uint) page)) == 0) {
+        p->ram_size += LPGSIZE;
+        return 1;
+    }
+    n = 0;
+    pages[n++] = page;
+    if ((locked = unloaded_exe_page(p, page))) {
+        start = (char *) ((uint) page / (FAULTAROUND * PGSIZE) * (FAULTAROUND * PGSIZE));
+        end = advice_at(p, page) == MADV_RANDOM ? start : start + FAULTAROUND * PGSIZE;
+        for (va = start; va < end; va += PGSIZE)
+            if (va != page && unloaded_exe_page(p, va))
+                pages[n++] = va;
+        // A system call reading the executable itself may be the one faulting
+        if (holdingsleep(&p->exe->lock))
+            locked = 0;
+        else
+            ilock(p->exe);
+    } else if (!write) {
+        return mapzero(p->pgdir, page) == 0;
+    }
+
+    make_room(n);
+    for (i = 0; i < n; i++) {
+        if (loadpage(p->pgdir, p->exe, p->segs, p->nseg, pages[i], PTE_W | PTE_U) < 0)
+            break;
+        p->ram_size += PGSIZE;
+        add_resident_page(p, pages[i], 0);
+    }
+    if (locked)
+        iunlock(p->exe);
+    return i > 0;
+}
+
+// Handle a fault of p on addr, with error code err. Returns 1 if
+// the faulting access can be retried.
+uint handle_page_fault(struct proc *p, uint addr, uint err) {
+    struct vma *v;
+    pte_t *pte;
+    char *pages[SWAPCLUSTER];
+    int n, j, zero;
+
+    // The page of the address that caused the page fault
     char *page = (char *) (PGROUNDDOWN(addr));
 
     // Find the PTE of the address
     pte = walkpgdir(p->pgdir, (void *) addr, 0);
 
+    // First touch of heap that sbrk() only reserved, or of the program
+    // image, or of a page of a memory mapping
+    if (pte == 0 || !(*pte & (PTE_P | PTE_PG))) {
+        if (addr < p->total_size) {
+            if (unloaded_exe_page(p, page))
+                p->major_faults++;
+            return map_new_page(p, page, err & FEC_WR);
+        }
+        if ((v = findvma(p, addr)) != 0 && v->file)
+            p->major_faults++;
+        return mmapfault(p, page, err & FEC_WR);
+    }
+
+    // A write to a page shared with the parent or a child after fork,
+    // or to the zero page
+    if ((*pte & (PTE_P | PTE_U | PTE_COW)) == (PTE_P | PTE_U | PTE_COW)) {
+        // Only a copy of the zero page takes up RAM
+        if ((zero = zeromapped(pte)))
+            make_room(1);
+        if (!copy_on_write(pte, page))
+            return 0;
+        if (zero) {
+            p->ram_size += PGSIZE;
+            add_resident_page(p, page, 0);
+            return 1;
+        }
+#ifdef GLOBAL
+        // The page may have a frame of its own now
+        rmap_add(p, page);
+#endif
+        return 1;
+    }
+
     // If the page is protected against writing and is not paged out
     if (!(*pte & PTE_W) && !(*pte & PTE_PG)) {
         p->tf->trapno = 13;
         return 0;
     }
-#ifdef NONE
-    return 0;
-#endif
 
     // If the page is not paged out- nothing we can do about it, must be a bug or misbehave
     if (!(*pte & PTE_PG)) return 0;
 
-    turn_off_page_flags((char *) addr, PTE_PG);
-    light_page_flags((char *) addr, PTE_P);
-    lcr3(V2P(p->pgdir));
-
-    restore_page_from_disk(page);
+    if ((n = restore_page_from_disk(page, pte, pages)) == 0)
+        return 0;
+    p->major_faults++;
 
     // raise ram size
-    p->ram_size += PGSIZE;
+    p->ram_size += n * PGSIZE;
 
     // Swap out more pages if needed
-    swap_out_num_pages(p->ram_size / PGSIZE - MAX_PSYC_PAGES);
+    make_room(0);
 
-#ifdef LIFO
-    // Push the page to the stack of swapped in pages
-    p->pages_on_ram[p->pages_on_ram_stack_pointer++] = page;
-#endif
-#ifdef SCFIFO
-    // Find the first empty spot
-    uint i;
-    for (i = 0; p->pages_on_ram[i] != 0 && i <= MAX_PSYC_PAGES; ++i);
-    if (i > MAX_PSYC_PAGES) panic("handle_pgflt couldn't find free spot");
-    p->pages_on_ram[i] = page;
-#endif
+    // Push the pages to the stack (LIFO), the end of the queue (SCFIFO) or
+    // among the aged pages (NFUA, LAPA)
+    for (j = 0; j < n; j++)
+        add_resident_page(p, pages[j], 1);
 
     return 1;
 }
 
+// Called from trap() on a page fault, with its error code. Returns 1
+// if the faulting access can be retried.
+uint page_fault_handler(uint err) {
+    struct proc *p = myproc();
+    uint64 start;
+    uint r;
+
+    // Faulting a page in may sleep, which can't be done holding a
+    // spinlock; the kernel pins buffers it uses under one, see pin()
+    if (mycpu()->ncli > 0)
+        return 0;
+    start = rdtsc();
+    p->page_faults++;
+    p->paging++;
+    r = handle_page_fault(p, rcr2(), err);
+    p->paging--;
+    p->fault_cycles += rdtsc() - start;
+    return r;
+}
+
+// Free p's pages in [start, end), page aligned, and their swap slots.
+// Large pages only partly in the range are split first.
+// Returns 0, or -1 if out of memory.
+static int free_range(struct proc *p, uint start, uint end) {
+    uint a;
+    pte_t *pte;
+
+    if (start % LPGSIZE != 0 && split_large_page(p, (char *) start) < 0)
+        return -1;
+    if (end % LPGSIZE != 0 && split_large_page(p, (char *) end) < 0)
+        return -1;
+
+    // Only the pages with a frame of their own in RAM count against ram_size
+    for (a = start; a < end; a += PGSIZE) {
+        if (p->pgdir[PDX(a)] & PTE_PS) {
+            p->ram_size -= LPGSIZE;
+            a += LPGSIZE - PGSIZE;
+        } else if ((pte = walkpgdir(p->pgdir, (char *) a, 0)) && (*pte & PTE_P) && !zeromapped(pte)) {
+            p->ram_size -= PGSIZE;
+        }
+    }
+    deallocuvm(p->pgdir, end, start);
+    pages_freed(p, start, end);
+    return 0;
+}
+
+// Shrink the current process's memory by -n bytes.
 int growproc_helper(int n) {
     struct proc *curproc = myproc();
     uint sz = curproc->total_size;
 
-    if (n > 0) {
-        if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-            return -1;
-    } else if (n < 0) {
-        if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-            return -1;
-    }
-    curproc->total_size = sz;
-    curproc->ram_size += n;
+    if (free_range(curproc, PGROUNDUP(sz + n), PGROUNDUP(sz)) < 0)
+        return -1;
+    forget_range(curproc, PGROUNDUP(sz + n), PGROUNDUP(sz));
+    curproc->total_size = sz + n;
 
     switchuvm(curproc);
     return 0;
@@ -354,47 +1103,416 @@ int min(int a, int b) {
     return b;
 }
 
+// Growing only reserves address space: each new page gets a zeroed
+// frame when it is first touched (see map_new_page), so heap that is
+// never used costs neither RAM nor paging.
+int
+growproc_swapping(int n) {
+    struct proc *curproc = myproc();
+    uint sz = curproc->total_size;
+
+    if (n < 0)
+        return growproc_helper(n);
+    // The heap grows up to the lowest memory mapping
+    if (sz + n < sz || sz + n >= KERNBASE || sz + n > mmapbase(curproc))
+        return -1;
+    curproc->total_size = sz + n;
+    return 0;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n) {
-#ifdef NONE
-    return growproc_helper(n);
-#endif
-
     struct proc *curproc = myproc();
-    uint sz = curproc->total_size;
+    int r;
 
-    if (n < 0) {
-        return growproc_helper(n);
+    curproc->paging++;
+    r = growproc_swapping(n);
+    curproc->paging--;
+    return r;
+}
+
+// Set the current process's resident limit to npages pages,
+// paging out what no longer fits.
+int
+set_ram_limit(int npages) {
+    if (npages < 1)
+        return -1;
+    myproc()->ram_limit = npages;
+    myproc()->paging++;
+    make_room(0);
+    myproc()->paging--;
+    return 0;
+}
+
+// Switch the current process to replacement policy policy (see policy.h),
+// or with all, every process.
+int
+set_policy(int policy, int all) {
+    struct proc *p;
+
+    if (policy < 0 || policy >= NELEM(policies))
+        return -1;
+    if (!all) {
+        myproc()->policy = policy;
+        return 0;
     }
+    acquire(&ptable.lock);
+    // Free slots get theirs from fork() or userinit()
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if (p->state != UNUSED)
+            p->policy = policy;
+    release(&ptable.lock);
+    return 0;
+}
 
-    uint overall_pages = (sz + n) / PGSIZE;
-    if (overall_pages > MAX_TOTAL_PAGES) return -1;
+// Return an unused entry of table r, with n entries, or 0.
+static struct range *range_alloc(struct range *r, int n) {
+    int i;
 
-    while (n > 0) {
-        uint available_pages_to_swap = 0;
+    for (i = 0; i < n; i++)
+        if (r[i].end == 0)
+            return &r[i];
+    return 0;
+}
 
-#ifdef SCFIFO
-        for (uint i = 0; i < MAX_PSYC_PAGES; ++i) if (curproc->pages_on_ram[i]) available_pages_to_swap++;
-#endif
-#ifdef LIFO
-        available_pages_to_swap = curproc->pages_on_ram_stack_pointer;
-#endif
+// Give [start, end) value in table r, with n entries, instead of
+// the values it had; value 0 just takes them away.
+// Returns 0, or -1 if there is no room in r.
+static int set_range(struct range *r, int n, uint start, uint end, int value) {
+    struct range *a, *b;
+    int need, room;
+
+    // An entry reaching past both ends is split in two
+    need = value != 0;
+    for (a = r, room = 0; a < &r[n]; a++) {
+        if (a->end == 0)
+            room++;
+        else if (a->start < start && a->end > end)
+            need++;
+    }
+    if (need > room)
+        return -1;
+
+    for (a = r; a < &r[n]; a++) {
+        if (a->end == 0 || a->end <= start || a->start >= end)
+            continue;
+        if (a->start < start && a->end > end) {
+            b = range_alloc(r, n);
+            *b = *a;
+            b->start = end;
+            a->end = start;
+        } else if (a->start < start) {
+            a->end = start;
+        } else if (a->end > end) {
+            a->start = end;
+        } else {
+            a->end = 0;
+        }
+    }
+    if (value != 0) {
+        b = range_alloc(r, n);
+        b->start = start;
+        b->end = end;
+        b->value = value;
+    }
+    return 0;
+}
 
-        uint need_to_swap = PGROUNDUP((int) (curproc->ram_size + n)) / PGSIZE - MAX_PSYC_PAGES;
-        int pages_to_swap = min(need_to_swap, available_pages_to_swap);
+// How many pages of [start, end) the entries of table r, with n
+// entries, cover.
+static uint range_pages(struct range *r, int n, uint start, uint end) {
+    uint lo, hi, npages = 0;
+    int i;
 
-        swap_out_num_pages(pages_to_swap);
+    for (i = 0; i < n; i++) {
+        lo = r[i].start > start ? r[i].start : start;
+        hi = r[i].end < end ? r[i].end : end;
+        if (r[i].end != 0 && lo < hi)
+            npages += (hi - lo) / PGSIZE;
+    }
+    return npages;
+}
 
-        uint cur_mem = min(n, MAX_PSYC_PAGES * PGSIZE - curproc->ram_size);
+// Record that p will use [start, end) as advice (MADV_NORMAL,
+// MADV_SEQUENTIAL or MADV_RANDOM) says, instead of what was recorded
+// for it. Returns 0, or -1 if there is no room to record it.
+static int set_advice(struct proc *p, uint start, uint end, int advice) {
+    return set_range(p->advice, NADVICE, start, end, advice);
+}
 
-        growproc_helper(cur_mem);
+// p's pages in [start, end) were unmapped: forget their advice and
+// locks. These ranges never split an entry, so there is always room.
+void
+forget_range(struct proc *p, uint start, uint end) {
+    set_range(p->advice, NADVICE, start, end, MADV_NORMAL);
+    set_range(p->mlocks, NMLOCK, start, end, 0);
+}
 
-        n -= cur_mem;
+// Page in the paged out pages of p in [start, end), with one disk
+// read for each run of them in adjacent swap slots, until the
+// resident limit is reached. Returns 0, or -1 if out of memory.
+static int prefetch(struct proc *p, uint start, uint end) {
+    char *pages[SWAPCLUSTER];
+    pte_t *ptes[SWAPCLUSTER];
+    uint a;
+    int n, i, room;
+
+    for (a = start; a < end && (room = ram_room()) > 0; a += n * PGSIZE) {
+        for (n = 0; n < SWAPCLUSTER && n < room && a + n * PGSIZE < end; n++) {
+            pages[n] = (char *) a + n * PGSIZE;
+            ptes[n] = walkpgdir(p->pgdir, pages[n], 0);
+            if (ptes[n] == 0 || !(*ptes[n] & PTE_PG) || (n > 0 && PTE_SLOT(*ptes[n]) != PTE_SLOT(*ptes[0]) + n))
+                break;
+        }
+        if (n == 0) {
+            n = 1;
+            continue;
+        }
+        if ((n = swap_in(pages, ptes, n)) == 0)
+            return -1;
+        p->ram_size += n * PGSIZE;
+        for (i = 0; i < n; i++)
+            add_resident_page(p, pages[i], 1);
     }
+    return 0;
+}
 
-    switchuvm(curproc);
+// Drop p's pages in [start, end), page aligned and all in its heap or
+// in one mapping, and their swap slots. Touching them again finds
+// them as if they never were: zeroed, or read from the executable or
+// the mapped file. Dirty pages of a shared file mapping are written
+// back first. Returns 0, or -1 for the stack guard page, shared
+// memory segments, or when out of memory.
+static int drop_range(struct proc *p, uint start, uint end) {
+    struct vma *v;
+    pte_t *pte;
+    uint a;
+
+    if ((v = findvma(p, start)) != 0 && v->shm)
+        return -1;
+    for (a = start; a < end; a += PGSIZE)
+        if (!(p->pgdir[PDX(a)] & PTE_PS) && (pte = walkpgdir(p->pgdir, (char *) a, 0)) &&
+            (*pte & PTE_P) && !(*pte & PTE_U))
+            return -1;
+    if (v)
+        mmapsync(p, v, start, end);
+    if (free_range(p, start, end) < 0)
+        return -1;
+    lcr3(V2P(p->pgdir));
+    return 0;
+}
+
+// Tell the pager how the current process will use [addr, addr+len),
+// which must lie in its heap or in one mapping; see mman.h for the
+// advice. Returns 0, or -1.
+int
+madvise(uint addr, uint len, int advice) {
+    struct proc *p = myproc();
+    uint end = PGROUNDUP(addr + len);
+    int r;
+
+    if (addr % PGSIZE != 0 || len == 0 || end < addr || end > PGROUNDUP(userend(p, addr)))
+        return -1;
+    p->paging++;
+    switch (advice) {
+    case MADV_WILLNEED:
+        r = prefetch(p, addr, end);
+        break;
+    case MADV_DONTNEED:
+        r = drop_range(p, addr, end);
+        break;
+    case MADV_NORMAL:
+    case MADV_SEQUENTIAL:
+    case MADV_RANDOM:
+        r = set_advice(p, addr, end, advice);
+        break;
+    default:
+        r = -1;
+    }
+    p->paging--;
+    return r;
+}
+
+// Is va of p in a mapping whose pages never go in its resident set?
+static int pinned_mapping(struct proc *p, char *va) {
+    struct vma *v = findvma(p, (uint) va);
+
+    return v && (v->shm || (v->file && (v->flags & MAP_SHARED)));
+}
+
+// Make page va of p present, and writable if write, as an access
+// to it would: fault it in if need be. Returns 0 if the access would
+// fail.
+static int touch_page(struct proc *p, char *va, int write) {
+    pte_t *pte = walkpgdir(p->pgdir, va, 0);
+
+    if (pte && (*pte & PTE_P)) {
+        if (!write || (*pte & PTE_W))
+            return 1;
+        if (!(*pte & PTE_COW))
+            return 0;
+    }
+    return handle_page_fault(p, (uint) va, write ? FEC_WR : 0);
+}
+
+// Touch page va of p, as touch_page() does, and take it out of p's
+// resident set, so it stays in RAM. A large page is split first.
+// Returns 1 if it was in the resident set, 0 if not, or -1 if the
+// access would fail or when out of memory.
+static int hold_page(struct proc *p, char *va, int write) {
+    // A large page may be mapped on the fault
+    if (split_large_page(p, va) < 0 || !touch_page(p, va, write) || split_large_page(p, va) < 0)
+        return -1;
+    return rsdel(p, va) == 0;
+}
+
+// Page in the pages of [addr, addr+n), at most PINPAGES of them, all
+// in the current process's heap or in one mapping, writable if write,
+// and keep them in RAM until unpin(). The kernel copies to and from
+// such buffers holding spinlocks, when a page fault can't sleep.
+// *held gets a bit for each page taken out of the resident set.
+// Returns 0, or -1 with nothing pinned.
+int
+pin(uint addr, uint n, int write, uint *held) {
+    struct proc *p = myproc();
+    uint a, start = PGROUNDDOWN(addr);
+    int r = 0;
+
+    *held = 0;
+    if (PGROUNDUP(addr + n) - start > PINPAGES * PGSIZE)
+        return -1;
+    p->paging++;
+    for (a = start; a < addr + n; a += PGSIZE) {
+        if ((r = hold_page(p, (char *) a, write)) < 0)
+            break;
+        if (r)
+            *held |= 1 << (a - start) / PGSIZE;
+    }
+    p->paging--;
+    if (r < 0) {
+        unpin(addr, *held);
+        return -1;
+    }
+    return 0;
+}
+
+// Would touching [addr, addr+n) of the current process read a file:
+// does it have pages of the executable or of a mapped file that
+// weren't loaded yet?
+int
+filebacked(uint addr, uint n) {
+    struct proc *p = myproc();
+    struct vma *v;
+    pte_t *pte;
+    uint a;
+
+    for (a = PGROUNDDOWN(addr); a < addr + n; a += PGSIZE) {
+        if (unloaded_exe_page(p, (char *) a))
+            return 1;
+        if ((v = findvma(p, a)) != 0 && v->file &&
+            ((pte = walkpgdir(p->pgdir, (char *) a, 0)) == 0 || !(*pte & (PTE_P | PTE_PG))))
+            return 1;
+    }
+    return 0;
+}
+
+// Put the pages pin() took out of the resident set back in.
+void
+unpin(uint addr, uint held) {
+    struct proc *p = myproc();
+    int i;
+
+    p->paging++;
+    for (i = 0; i < PINPAGES; i++)
+        if (held & (1 << i))
+            add_resident_page(p, (char *) PGROUNDDOWN(addr) + i * PGSIZE, 0);
+    p->paging--;
+}
+
+// Put the pages of p in [start, end) that mlock() kept out of its
+// resident set back in, e.g. for a child's copies of them after fork().
+static void unlock_pages(struct proc *p, uint start, uint end) {
+    uint a;
+    pte_t *pte;
+
+    for (a = start; a < end; a += PGSIZE)
+        if ((pte = walkpgdir(p->pgdir, (char *) a, 0)) && (*pte & PTE_P) && !zeromapped(pte) &&
+            !pinned_mapping(p, (char *) a))
+            add_resident_page(p, (char *) a, 0);
+}
+
+// Lock the pages of [addr, addr+len), which must lie in the current
+// process's heap or in one mapping, in RAM: page them in now, and
+// keep them out of the resident set, so no policy picks them as
+// victims. They count against the process's lock limit.
+// Returns 0, or -1, leaving the locks as they were.
+int
+mlock(uint addr, uint len) {
+    struct proc *p = myproc();
+    struct range old[NMLOCK];
+    uint end = PGROUNDUP(addr + len);
+    uint a, locked;
+    struct vma *v;
+    int write, r;
+
+    if (addr % PGSIZE != 0 || len == 0 || end < addr || end > PGROUNDUP(userend(p, addr)))
+        return -1;
+    locked = range_pages(p->mlocks, NMLOCK, 0, KERNBASE);
+    if (locked + (end - addr) / PGSIZE - range_pages(p->mlocks, NMLOCK, addr, end) > p->mlock_limit)
+        return -1;
+    memmove(old, p->mlocks, sizeof(old));
+    if (set_range(p->mlocks, NMLOCK, addr, end, 1) < 0)
+        return -1;
+
+    // Writable pages are made writable now, copied from the zero page
+    // or from a frame still shared since fork, so a write to a locked
+    // page never faults
+    write = (v = findvma(p, addr)) == 0 || (v->prot & PROT_WRITE);
+    p->paging++;
+    for (a = addr, r = 0; a < end && r == 0; a += PGSIZE)
+        if (hold_page(p, (char *) a, write) < 0)
+            r = -1;
+    if (r < 0) {
+        // Only the pages this call locked are unlocked again
+        memmove(p->mlocks, old, sizeof(old));
+        for (a = addr; a < end; a += PGSIZE) {
+            if (range_at(old, NMLOCK, (char *) a))
+                continue;
+            // Pages it didn't get to may still be in the resident set
+            rsdel(p, (char *) a);
+            unlock_pages(p, a, a + PGSIZE);
+        }
+    }
+    p->paging--;
+    return r;
+}
+
+// Undo mlock() for the pages of [addr, addr+len): they go back in the
+// current process's resident set. Returns 0, or -1.
+int
+munlock(uint addr, uint len) {
+    struct proc *p = myproc();
+    struct range old[NMLOCK];
+    uint end = PGROUNDUP(addr + len);
+    uint lo, hi;
+    int i;
+
+    if (addr % PGSIZE != 0 || len == 0 || end < addr || end > PGROUNDUP(userend(p, addr)))
+        return -1;
+    memmove(old, p->mlocks, sizeof(old));
+    if (set_range(p->mlocks, NMLOCK, addr, end, 0) < 0)
+        return -1;
+
+    p->paging++;
+    for (i = 0; i < NMLOCK; i++) {
+        lo = old[i].start > addr ? old[i].start : addr;
+        hi = old[i].end < end ? old[i].end : end;
+        if (old[i].end != 0 && lo < hi)
+            unlock_pages(p, lo, hi);
+    }
+    p->paging--;
     return 0;
 }
 
@@ -412,23 +1530,46 @@ fork(void) {
         return -1;
     }
 
-    // Copy process state from proc.
-    if ((np->pgdir = copyuvm(curproc->pgdir, curproc->total_size)) == 0) {
+    // Copy process state from proc. Large pages are shared
+    // copy-on-write a small page at a time, so they are split first.
+    curproc->paging++;
+    while ((i = split_any_large_page(curproc)) > 0)
+        ;
+    if (i < 0)
+        np->pgdir = 0;
+    else if ((np->pgdir = copyuvm(curproc->pgdir, curproc->total_size)) != 0 &&
+             (copymaps(np->pgdir, curproc) < 0 || rsdup(np, curproc) < 0)) {
+        rsfree(np);
+        freevm(np->pgdir);
+        np->pgdir = 0;
+    }
+    curproc->paging--;
+    if (np->pgdir == 0) {
         kfree(np->kstack);
         np->kstack = 0;
         np->state = UNUSED;
         return -1;
     }
+    // copyuvm() took write access away from our shared pages
+    lcr3(V2P(curproc->pgdir));
     np->total_size = curproc->total_size;
     np->ram_size = curproc->ram_size;
-
-    np->pages_on_ram_stack_pointer = curproc->pages_on_ram_stack_pointer;
-    memmove(np->pages_on_ram, curproc->pages_on_ram, sizeof(char *) * 16);
-    memmove(np->swapped_pages_entry, curproc->swapped_pages_entry, sizeof(char *) * 16);
+    np->ram_limit = curproc->ram_limit;
+    np->mlock_limit = curproc->mlock_limit;
+    np->policy = curproc->policy;
+    np->large_pages = curproc->large_pages;
 
     np->protected_pages = curproc->protected_pages;
     np->page_faults = 0;
     np->total_paged_out = 0;
+    np->major_faults = 0;
+    np->pages_in = 0;
+    np->swap_bytes = 0;
+    np->fault_cycles = 0;
+    np->swap_cycles = 0;
+    np->last_fault = 0;
+    np->fault_stride = 0;
+    np->readahead = 0;
 
 
     np->parent = curproc;
@@ -441,21 +1582,24 @@ fork(void) {
         if (curproc->ofile[i])
             np->ofile[i] = filedup(curproc->ofile[i]);
     np->cwd = idup(curproc->cwd);
+    if (curproc->exe)
+        np->exe = idup(curproc->exe);
+    for (i = 0; i < curproc->nseg; i++)
+        np->segs[i] = curproc->segs[i];
+    np->nseg = curproc->nseg;
+    dupmaps(np, curproc);
+    for (i = 0; i < NADVICE; i++)
+        np->advice[i] = curproc->advice[i];
+    // Locks aren't inherited: the child's copies of locked pages go in its resident set
+    memset(np->mlocks, 0, sizeof(np->mlocks));
+    for (i = 0; i < NMLOCK; i++)
+        if (curproc->mlocks[i].end != 0)
+            unlock_pages(np, curproc->mlocks[i].start, curproc->mlocks[i].end);
 
     safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
     pid = np->pid;
 
-    if (curproc->swapFile) {
-        struct stat st;
-        filestat(curproc->swapFile, &st);
-        for (i = 0; i < st.size; i += 1024) {
-            char buf[1024];
-            readFromSwapFile(curproc, buf, i, 1024);
-            writeToSwapFile(np, buf, i, 1024);
-        }
-    }
-
     acquire(&ptable.lock);
 
     np->state = RUNNABLE;
@@ -481,6 +1625,9 @@ exit(void) {
     if (curproc == initproc)
         panic("init exiting");
 
+    // Write back shared file mappings while their files are open
+    unmapall();
+
     // Close all open files.
     for (fd = 0; fd < NOFILE; fd++) {
         if (curproc->ofile[fd]) {
@@ -488,13 +1635,14 @@ exit(void) {
             curproc->ofile[fd] = 0;
         }
     }
-#ifndef NONE
-    removeSwapFile(curproc);
-#endif
     begin_op();
     iput(curproc->cwd);
+    if (curproc->exe)
+        iput(curproc->exe);
     end_op();
     curproc->cwd = 0;
+    curproc->exe = 0;
+    curproc->nseg = 0;
 
     acquire(&ptable.lock);
 
@@ -538,6 +1686,8 @@ wait(void) {
                 kfree(p->kstack);
                 p->kstack = 0;
                 freevm(p->pgdir);
+                p->pgdir = 0;
+                rsfree(p);
                 p->pid = 0;
                 p->parent = 0;
                 p->name[0] = 0;
@@ -736,6 +1886,64 @@ kill(int pid) {
     return -1;
 }
 
+// How many of p's pages in [start, end) are paged out.
+static uint paged_out_range(struct proc *p, uint start, uint end) {
+    pte_t *pte;
+    uint a, n = 0;
+
+    for (a = start; a < end; a += PGSIZE)
+        if ((pte = walkpgdir(p->pgdir, (char *) a, 0)) && (*pte & PTE_PG))
+            n++;
+    return n;
+}
+
+// How many of p's pages are paged out, in its heap and mappings.
+// With heap allocated on first touch, that is no longer everything
+// that isn't in RAM.
+static uint paged_out_pages(struct proc *p) {
+    uint n = paged_out_range(p, 0, p->total_size);
+    int i;
+
+    for (i = 0; i < NVMA; i++)
+        if (p->vmas[i].end != 0)
+            n += paged_out_range(p, p->vmas[i].start, p->vmas[i].end);
+    return n;
+}
+
+// Fill in st with the memory and paging counters of process pid,
+// or of the current process if pid is 0. Returns 0, or -1 if there
+// is no such process.
+int
+getmemstats(int pid, struct memstats *st) {
+    struct memstats s;
+    struct proc *p;
+
+    acquire(&ptable.lock);
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if (p->state != UNUSED && p->state != EMBRYO && p->pid == (pid ? pid : myproc()->pid))
+            break;
+    if (p == &ptable.proc[NPROC]) {
+        release(&ptable.lock);
+        return -1;
+    }
+    s.minor_faults = p->page_faults - p->major_faults;
+    s.major_faults = p->major_faults;
+    s.pages_in = p->pages_in;
+    s.pages_out = p->total_paged_out;
+    s.swap_bytes = p->swap_bytes;
+    s.resident_pages = p->ram_size / PGSIZE;
+    // Another process's page table may be changing unless it may be robbed
+    s.swapped_pages = may_rob(p) && p->pgdir ? paged_out_pages(p) : 0;
+    s.locked_pages = range_pages(p->mlocks, NMLOCK, 0, KERNBASE);
+    s.fault_cycles = p->fault_cycles;
+    s.swap_cycles = p->swap_cycles;
+    release(&ptable.lock);
+
+    // st is in user memory, which may fault
+    *st = s;
+    return 0;
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -770,10 +1978,11 @@ procdump(void) {
             state = "???";
         cprintf("%d %s ", p->pid, state);
 
-        uint swapped = (p->total_size - p->ram_size) / PGSIZE;
+        // Only page tables that can't be changing now are walked
+        uint swapped = may_rob(p) && p->pgdir ? paged_out_pages(p) : 0;
 
-        cprintf("%d %d %d %d %d ", p->total_size / PGSIZE, swapped, p->protected_pages, p->page_faults,
-                p->total_paged_out);
+        cprintf("%d %d %d %d %d %d ", p->total_size / PGSIZE, swapped, p->protected_pages, p->page_faults,
+                p->total_paged_out, range_pages(p->mlocks, NMLOCK, 0, KERNBASE));
         cprintf("%s", p->name);
 
         if (p->state == SLEEPING) {
@@ -782,7 +1991,7 @@ procdump(void) {
                 cprintf(" %p", pc[i]);
         }
         cprintf("\n");
-        free_pages -= p->total_size / PGSIZE;
+        free_pages -= p->ram_size / PGSIZE;
     }
 
     cprintf("%d / %d free pages in the system\n", free_pages, total_pages);
@@ -799,7 +2008,7 @@ void single_process_dump(void) {
         if (p->state == UNUSED) {
             continue;
         }
-        free_pages -= p->total_size / PGSIZE;
+        free_pages -= p->ram_size / PGSIZE;
     }
     p = myproc();
     int i;
@@ -810,10 +2019,10 @@ void single_process_dump(void) {
     state = "tunning";
     cprintf("%d %s ", p->pid, state);
 
-    uint swapped = (p->total_size - p->ram_size) / PGSIZE;
+    uint swapped = paged_out_pages(p);
 
-    cprintf("%d %d %d %d %d ", p->total_size / PGSIZE, swapped, p->protected_pages, p->page_faults,
-            p->total_paged_out);
+    cprintf("%d %d %d %d %d %d ", p->total_size / PGSIZE, swapped, p->protected_pages, p->page_faults,
+            p->total_paged_out, range_pages(p->mlocks, NMLOCK, 0, KERNBASE));
     cprintf("%s", p->name);
 
     if (p->state == SLEEPING) {
@@ -1,7 +1,4 @@
 // Per-CPU state
-#define MAX_PSYC_PAGES 16
-#define MAX_TOTAL_PAGES 32
-
 struct cpu {
     uchar apicid;                // Local APIC ID
     struct context *scheduler;   // swtch() here to enter scheduler
@@ -43,6 +40,38 @@ enum procstate {
     UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE
 };
 
+// A page in a resident set
+struct rsentry {
+    char *va;
+    uint age;                    // For NFUA and LAPA, see age_pages()
+};
+
+// A loadable segment of the executable. Its pages are read in
+// when they are first touched, see map_new_page().
+struct segment {
+    uint vaddr;                  // Where it starts in memory
+    uint filesz;                 // Bytes read from the file, zeros after
+    uint off;                    // Where it starts in the file
+};
+
+// A memory mapping made by mmap(), see mmap.c
+struct vma {
+    uint start;                  // First address, page aligned
+    uint end;                    // Past the last page, or 0 if unused
+    int prot;                    // PROT_ bits, see mman.h
+    int flags;                   // MAP_ bits
+    struct file *file;           // Mapped file, or 0 for MAP_ANON
+    uint off;                    // Where start is in the file
+    struct shm *shm;             // Attached shared memory segment, or 0
+};
+
+// An address range with a value, e.g. the access pattern madvise() was told
+struct range {
+    uint start;
+    uint end;                    // 0 if unused
+    int value;                   // Never 0
+};
+
 // Per-process state
 struct proc {
     uint total_size;                     // Size of process memory (bytes)
@@ -59,17 +88,35 @@ struct proc {
     struct file *ofile[NOFILE];  // Open files
     struct inode *cwd;           // Current directory
     char name[16];               // Process name (debugging)
+    struct inode *exe;           // Executable, or 0 before the first exec
+    struct segment segs[NELFSEG];  // Its loadable segments
+    int nseg;                    // # of entries in segs
+    struct vma vmas[NVMA];       // Memory mappings, above the heap
+    struct range advice[NADVICE];  // Access patterns (MADV_ values), see madvise()
+    struct range mlocks[NMLOCK];  // Ranges kept in RAM, see mlock()
+    uint mlock_limit;            // Max # of pages in them
 
-    //Swap file. must initiate with create swap file
-    struct file *swapFile;      //page file
-    char *swapped_pages_entry[16];    // In the i'th entry- the pte of the page written in the swap file i * PGSIZE offset
+    struct rsentry **pages_on_ram;  // Resident set, see rset.c
+    uint num_pages_on_ram;       // # of pages in the resident set
+    uint pages_on_ram_head;      // Where the resident set starts
+    uint pages_on_ram_room;      // # of pages the resident set has room for
+    uint ram_limit;              // Max # of resident pages before paging out
+    int paging;                  // If non-zero, changing its own memory map
+    int policy;                  // Page replacement policy, see policy.h
+    int large_pages;             // If non-zero, big heap regions get large pages
 
-    uint pages_on_ram_stack_pointer;
-    char *pages_on_ram[16];
+    char *last_fault;            // Last page paged in on a fault (readahead)
+    int fault_stride;            // Distance between the last two such faults
+    uint readahead;              // Pages read in on the last such fault
 
     uint protected_pages;
     uint page_faults;
     uint total_paged_out;
+    uint major_faults;           // Faults that read swap or a file
+    uint pages_in;               // Pages read back from swap
+    uint swap_bytes;             // Bytes page-outs wrote to swap
+    uint64 fault_cycles;         // Time in the page fault handler
+    uint64 swap_cycles;          // Time in swap I/O
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -77,3 +124,4 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+//   memory mappings, down from KERNBASE (see mmap.c)
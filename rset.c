@@ -0,0 +1,200 @@
+// Resident sets.
+//
+// A process's resident set lists the user pages it has in RAM that
+// may be paged out, in the order they came in. It can grow to cover
+// the whole user address space, so it lives in pages from kalloc():
+// p->pages_on_ram points to a directory page, which points to pages
+// of entries. Entry pages are added as pages come into RAM and are
+// only given back when the process execs or is reaped.
+// Each entry also has an age, for the policies that keep one.
+//
+// The entries form a ring, starting at p->pages_on_ram_head, so
+// taking the oldest page or sending it to the back of the line
+// (second chance) takes constant time however big the set is.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+
+#define NENTRY (PGSIZE / sizeof(struct rsentry))    // entries per page
+#define NDIR   (PGSIZE / sizeof(struct rsentry *))  // pages per directory
+
+// Return the k'th entry in memory.
+static struct rsentry*
+slot(struct proc *p, uint k)
+{
+  return &p->pages_on_ram[k / NENTRY][k % NENTRY];
+}
+
+// Return the entry of the i'th page, oldest first.
+static struct rsentry*
+entry(struct proc *p, uint i)
+{
+  return slot(p, (p->pages_on_ram_head + i) % p->pages_on_ram_room);
+}
+
+// Make sure p's resident set has room for n pages.
+// Returns 0, or -1 if out of memory.
+int
+rsreserve(struct proc *p, uint n)
+{
+  uint room, k;
+
+  if(n > NDIR * NENTRY)
+    return -1;
+  if(p->pages_on_ram == 0){
+    if((p->pages_on_ram = (struct rsentry **)kalloc()) == 0)
+      return -1;
+    memset(p->pages_on_ram, 0, PGSIZE);
+  }
+  for(room = p->pages_on_ram_room; room < n; room += NENTRY)
+    if((p->pages_on_ram[room / NENTRY] = (struct rsentry *)kalloc()) == 0)
+      break;
+  if(room == p->pages_on_ram_room)
+    return room < n ? -1 : 0;
+
+  // If the ring wraps around, move its start up to the new end.
+  if(p->pages_on_ram_head + p->num_pages_on_ram > p->pages_on_ram_room){
+    for(k = p->pages_on_ram_room; k-- > p->pages_on_ram_head;)
+      *slot(p, k + room - p->pages_on_ram_room) = *slot(p, k);
+    p->pages_on_ram_head += room - p->pages_on_ram_room;
+  }
+  p->pages_on_ram_room = room;
+  return room < n ? -1 : 0;
+}
+
+// Add page va at the end of p's resident set, with age 0.
+// The room must have been reserved.
+void
+rspush(struct proc *p, char *va)
+{
+  struct rsentry *e;
+
+  if(p->num_pages_on_ram == p->pages_on_ram_room)
+    panic("rspush");
+  e = entry(p, p->num_pages_on_ram++);
+  e->va = va;
+  e->age = 0;
+}
+
+// Remove and return the last page of p's resident set.
+char *
+rspop(struct proc *p)
+{
+  if(p->num_pages_on_ram == 0)
+    panic("rspop");
+  return entry(p, --p->num_pages_on_ram)->va;
+}
+
+// Return the i'th page of p's resident set, oldest first.
+char *
+rsget(struct proc *p, uint i)
+{
+  if(i >= p->num_pages_on_ram)
+    panic("rsget");
+  return entry(p, i)->va;
+}
+
+// Return the age of the i'th page of p's resident set.
+uint*
+rsage(struct proc *p, uint i)
+{
+  if(i >= p->num_pages_on_ram)
+    panic("rsage");
+  return &entry(p, i)->age;
+}
+
+// Remove the i'th page of p's resident set.
+// Takes constant time for the oldest page.
+void
+rsremove(struct proc *p, uint i)
+{
+  if(i >= p->num_pages_on_ram)
+    panic("rsremove");
+  if(i == 0){
+    p->pages_on_ram_head = (p->pages_on_ram_head + 1) % p->pages_on_ram_room;
+    p->num_pages_on_ram--;
+    return;
+  }
+  for(; i + 1 < p->num_pages_on_ram; i++)
+    *entry(p, i) = *entry(p, i + 1);
+  p->num_pages_on_ram--;
+}
+
+// Move the oldest page of p's resident set to the end.
+void
+rsrotate(struct proc *p)
+{
+  struct rsentry e;
+
+  if(p->num_pages_on_ram == 0)
+    panic("rsrotate");
+  e = *entry(p, 0);
+  rsremove(p, 0);
+  *entry(p, p->num_pages_on_ram++) = e;
+}
+
+// Remove page va from p's resident set.
+// Returns 0, or -1 if it isn't there.
+int
+rsdel(struct proc *p, char *va)
+{
+  uint i;
+
+  for(i = 0; i < p->num_pages_on_ram; i++){
+    if(entry(p, i)->va == va){
+      rsremove(p, i);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Remove the pages in [start, end) from p's resident set,
+// after they were unmapped.
+void
+rsdrop(struct proc *p, uint start, uint end)
+{
+  uint i, j;
+
+  for(i = j = 0; i < p->num_pages_on_ram; i++)
+    if((uint)entry(p, i)->va < start || (uint)entry(p, i)->va >= end)
+      *entry(p, j++) = *entry(p, i);
+  p->num_pages_on_ram = j;
+}
+
+// Give np a copy of p's resident set.
+// Returns 0, or -1 if out of memory.
+int
+rsdup(struct proc *np, struct proc *p)
+{
+  uint i;
+
+  np->pages_on_ram_head = 0;
+  if(rsreserve(np, p->num_pages_on_ram) < 0)
+    return -1;
+  for(i = 0; i < p->num_pages_on_ram; i++)
+    *entry(np, i) = *entry(p, i);
+  np->num_pages_on_ram = p->num_pages_on_ram;
+  return 0;
+}
+
+// Empty p's resident set and free its pages.
+void
+rsfree(struct proc *p)
+{
+  uint i;
+
+  if(p->pages_on_ram){
+    for(i = 0; i < NDIR; i++)
+      if(p->pages_on_ram[i])
+        kfree((char *)p->pages_on_ram[i]);
+    kfree((char *)p->pages_on_ram);
+  }
+  p->pages_on_ram = 0;
+  p->pages_on_ram_head = 0;
+  p->pages_on_ram_room = 0;
+  p->num_pages_on_ram = 0;
+}
@@ -0,0 +1,236 @@
+// Shared memory segments.
+//
+// shmget() creates a segment of zeroed pages, or finds the one made
+// with the same key, and shmat() maps all of its frames into the
+// calling process as a mapping (see mmap.c), so processes that
+// attach it see each other's writes without copying. fork() gives
+// the child the same frames, not copy-on-write ones.
+//
+// The segment holds a reference to each of its frames, and every
+// page table mapping one holds another, so deallocuvm() and freevm()
+// only drop references. Segment pages never enter a resident set:
+// they stay in RAM, instead of being paged out by one process while
+// others still use them, and they don't count in ram_size.
+// shmrm() removes a segment: shmget() no longer finds it and it can't
+// be attached anymore, and it is freed once the last mapping of it
+// is gone. A segment that is never removed stays, even unattached.
+// Its list of frames takes a page from kalloc(), which limits it to
+// SHMMAXPAGES pages (4MB).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "mman.h"
+
+#define SHMMAXPAGES (PGSIZE / sizeof(char*))
+
+struct shm {
+  int key;              // 0 for a segment shmget() never finds again
+  uint npages;          // 0 if unused
+  int ref;              // # of mappings of it
+  int removed;          // shmrm() was called, free it at ref 0
+  char **frames;        // a page listing its frames
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shmtable");
+}
+
+// Return the id of the segment with key if there is one, and it has
+// at least npages pages, -1 if it's smaller, or -2 if there is none.
+// Caller holds shmtable.lock.
+static int
+shmfind(int key, uint npages)
+{
+  struct shm *s;
+
+  for(s = shmtable.shm; key != 0 && s < &shmtable.shm[NSHM]; s++)
+    if(s->npages != 0 && s->key == key)
+      return s->npages >= npages ? s - shmtable.shm : -1;
+  return -2;
+}
+
+// Return the segment with key, or one of size bytes made for it if
+// there is none. Key 0 always makes a new one.
+// Returns its id, or -1.
+int
+shmget(int key, uint size)
+{
+  char **frames;
+  struct shm *s;
+  uint npages, i;
+  int id;
+
+  npages = PGROUNDUP(size) / PGSIZE;
+  if(npages == 0 || npages > SHMMAXPAGES)
+    return -1;
+  acquire(&shmtable.lock);
+  id = shmfind(key, npages);
+  release(&shmtable.lock);
+  if(id != -2)
+    return id;
+
+  // Zero the pages without holding the lock
+  if((frames = (char**)kalloc()) == 0)
+    return -1;
+  for(i = 0; i < npages; i++){
+    if((frames[i] = kalloc()) == 0)
+      goto bad;
+    memset(frames[i], 0, PGSIZE);
+  }
+
+  acquire(&shmtable.lock);
+  // Another process may have made it meanwhile
+  if((id = shmfind(key, npages)) != -2){
+    release(&shmtable.lock);
+    goto bad;
+  }
+  for(s = shmtable.shm; s < &shmtable.shm[NSHM]; s++){
+    if(s->npages == 0){
+      s->key = key;
+      s->npages = npages;
+      s->ref = 0;
+      s->removed = 0;
+      s->frames = frames;
+      release(&shmtable.lock);
+      return s - shmtable.shm;
+    }
+  }
+  release(&shmtable.lock);
+  id = -1;
+
+bad:
+  while(i > 0)
+    kfree(frames[--i]);
+  kfree((char*)frames);
+  return id == -2 ? -1 : id;
+}
+
+// Map the frames of segment s at va of pgdir.
+// Returns 0, or -1 if out of memory.
+int
+shmmap(pde_t *pgdir, struct shm *s, uint va)
+{
+  uint i;
+
+  for(i = 0; i < s->npages; i++){
+    if(mapshared(pgdir, (char*)va + i * PGSIZE, s->frames[i], PTE_W | PTE_U) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Add a mapping of segment s, e.g. for a child after fork.
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtable.lock);
+  s->ref++;
+  release(&shmtable.lock);
+}
+
+// Free segment s if it was removed and nothing maps it anymore.
+// Caller holds shmtable.lock.
+static void
+shmfree(struct shm *s)
+{
+  uint i;
+
+  if(!s->removed || s->ref > 0)
+    return;
+  for(i = 0; i < s->npages; i++)
+    kfree(s->frames[i]);
+  kfree((char*)s->frames);
+  s->frames = 0;
+  s->npages = 0;
+}
+
+// Drop a mapping of segment s, which was just unmapped,
+// and free s if it was removed and that was the last one.
+void
+shmput(struct shm *s)
+{
+  acquire(&shmtable.lock);
+  s->ref--;
+  shmfree(s);
+  release(&shmtable.lock);
+}
+
+// Remove segment id, see above. Returns 0, or -1 if there is none.
+int
+shmrm(int id)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shmtable.shm[id];
+  acquire(&shmtable.lock);
+  if(s->npages == 0 || s->removed){
+    release(&shmtable.lock);
+    return -1;
+  }
+  s->key = 0;
+  s->removed = 1;
+  shmfree(s);
+  release(&shmtable.lock);
+  return 0;
+}
+
+// Attach segment id to the current process.
+// Returns its address, or -1.
+int
+shmat(int id)
+{
+  struct proc *p = myproc();
+  struct shm *s;
+  struct vma *v;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shmtable.shm[id];
+  acquire(&shmtable.lock);
+  if(s->npages == 0 || s->removed){
+    release(&shmtable.lock);
+    return -1;
+  }
+  s->ref++;
+  release(&shmtable.lock);
+
+  // Only frees s if it was removed meanwhile
+  if((v = vmaalloc(p, s->npages * PGSIZE)) == 0){
+    shmput(s);
+    return -1;
+  }
+  v->prot = PROT_READ | PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->shm = s;
+  if(shmmap(p->pgdir, s, v->start) < 0){
+    munmap(v->start, v->end - v->start);
+    return -1;
+  }
+  return v->start;
+}
+
+// Detach the segment attached at addr from the current process.
+// Returns 0, or -1 if there is none.
+int
+shmdt(uint addr)
+{
+  struct vma *v;
+
+  if((v = findvma(myproc(), addr)) == 0 || v->shm == 0 || v->start != addr)
+    return -1;
+  return munmap(v->start, v->end - v->start);
+}
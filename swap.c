@@ -0,0 +1,426 @@
+// Swap slots.
+//
+// Paged out pages live in the swap area, a range of raw disk
+// blocks that mkfs reserves past the file system. Slot n is the
+// page at block sb.swapstart + n * (PGSIZE / BSIZE). Swap I/O goes
+// straight to the disk driver: it skips the buffer cache and the
+// log, since swap contents never have to survive a crash.
+//
+// A paged out page's PTE records its slot (see PTE_SLOT).
+// fork() doesn't copy the parent's paged out pages; the child
+// refers to the same slots. So slots are reference counted, and a
+// slot is freed when the last process referring to it pages it
+// back in or unmaps it. Free slots are found through a bitmap.
+//
+// A page that is paged back in keeps its slot: the swap cache
+// remembers which slot still holds a copy of each frame, and holds
+// a reference to it, until the frame is freed. If the page isn't
+// written to before it is paged out again, the copy in swap is still
+// good and the page out needs no disk write. Slots only the cache
+// refers to are given up when swap space runs out.
+//
+// Pages that compress well don't go to disk right away: the pool
+// keeps them compressed in RAM, so paging them back in is just a
+// matter of decompressing. The pool is a log: new pages go at its
+// head, and when it is full the oldest ones still in use are written
+// to their slots on disk to make room.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "buf.h"
+
+extern struct superblock sb;  // fs.c
+
+#define MAPBITS 32
+#define ZMAXLEN (PGSIZE / 2)  // largest compressed page kept in the pool
+
+struct {
+  struct spinlock lock;
+  uint ref[NSWAPSLOT];  // # of page table entries referring to each slot
+  uint map[NSWAPSLOT / MAPBITS];  // bit set for slots in use
+  int hint;             // where the last allocation ended
+  ushort cache[PHYSTOP >> PGSHIFT];  // 1 + slot holding a copy of each frame, or 0
+  uint inpool[NSWAPSLOT];  // 1 + where in the pool each slot's page is, or 0
+  struct buf buf;       // the swap request being done, locked while in use
+} swaptable;
+
+// A compressed page in the pool, followed by its len bytes.
+struct zhdr {
+  ushort slot;
+  ushort len;           // 0 marks padding up to the end of the pool
+};
+
+#define ZSIZE(len) ((sizeof(struct zhdr) + (len) + 3) & ~3)
+
+// Under swaptable.buf's lock.
+struct {
+  char data[ZPOOLSIZE];
+  uint head;            // # of bytes ever added
+  uint tail;            // # of bytes ever dropped
+  char zbuf[ZMAXLEN];   // the page being compressed
+  char page[PGSIZE];    // a page being written from the pool to disk
+} zpool;
+
+#define INUSE(n) (swaptable.map[(n) / MAPBITS] & (1 << ((n) % MAPBITS)))
+
+void
+swapinit(void)
+{
+  initlock(&swaptable.lock, "swaptable");
+  initsleeplock(&swaptable.buf.lock, "swapbuf");
+}
+
+// Drop a reference to slot n. Caller holds swaptable.lock.
+static void
+slotput(int n)
+{
+  if(n < 0 || n >= NSWAPSLOT || swaptable.ref[n] < 1)
+    panic("swapfree");
+  if(--swaptable.ref[n] == 0){
+    swaptable.map[n / MAPBITS] &= ~(1 << (n % MAPBITS));
+    swaptable.inpool[n] = 0;  // its space is reused as the tail passes
+  }
+}
+
+// Find npages adjacent free slots and give them one reference each.
+// The search starts where the last one ended, so it usually
+// succeeds right away; full words of the map are skipped at once.
+// Caller holds swaptable.lock.
+static int
+findrun(int npages)
+{
+  int n, run, seen;
+
+  n = swaptable.hint;
+  for(run = 0, seen = 0; seen < NSWAPSLOT + npages; n++, seen++){
+    if(n == NSWAPSLOT)
+      n = run = 0;  // runs don't wrap around
+    if(n % MAPBITS == 0 && swaptable.map[n / MAPBITS] == ~0){
+      n += MAPBITS - 1;
+      seen += MAPBITS - 1;
+      run = 0;
+      continue;
+    }
+    if(INUSE(n)){
+      run = 0;
+      continue;
+    }
+    if(++run == npages){
+      for(n = n - npages + 1, run = 0; run < npages; run++){
+        swaptable.ref[n + run] = 1;
+        swaptable.map[(n + run) / MAPBITS] |= 1 << ((n + run) % MAPBITS);
+      }
+      swaptable.hint = (n + npages) % NSWAPSLOT;
+      return n;
+    }
+  }
+  return -1;
+}
+
+// Give up the slots that only the swap cache refers to.
+// Returns how many. Caller holds swaptable.lock.
+static int
+reclaim(void)
+{
+  int i, n;
+
+  for(i = n = 0; i < NELEM(swaptable.cache); i++){
+    if(swaptable.cache[i] != 0 && swaptable.ref[swaptable.cache[i] - 1] == 1){
+      slotput(swaptable.cache[i] - 1);
+      swaptable.cache[i] = 0;
+      n++;
+    }
+  }
+  return n;
+}
+
+// Allocate npages adjacent swap slots, with one reference each,
+// so they can be written with a single disk command.
+// Returns the first slot, or -1 if there is no such run.
+int
+swapalloc(int npages)
+{
+  int n;
+
+  acquire(&swaptable.lock);
+  if((n = findrun(npages)) < 0 && reclaim() > 0)
+    n = findrun(npages);
+  release(&swaptable.lock);
+  return n;
+}
+
+// Add a reference to slot n, e.g. for a child after fork.
+void
+swapdup(int n)
+{
+  acquire(&swaptable.lock);
+  if(n < 0 || n >= NSWAPSLOT || swaptable.ref[n] < 1)
+    panic("swapdup");
+  swaptable.ref[n]++;
+  release(&swaptable.lock);
+}
+
+// Drop a reference to slot n.
+void
+swapfree(int n)
+{
+  acquire(&swaptable.lock);
+  slotput(n);
+  release(&swaptable.lock);
+}
+
+// Frame v was just read in from slot n. The swap cache takes over
+// the caller's reference to n.
+void
+swapcacheadd(char *v, int n)
+{
+  acquire(&swaptable.lock);
+  if(swaptable.cache[V2P(v) >> PGSHIFT] != 0)
+    panic("swapcacheadd");
+  swaptable.cache[V2P(v) >> PGSHIFT] = n + 1;
+  release(&swaptable.lock);
+}
+
+// If a slot still holds a copy of frame v, return it with a new
+// reference for the caller; otherwise return -1.
+int
+swapcachedup(char *v)
+{
+  int n;
+
+  acquire(&swaptable.lock);
+  n = swaptable.cache[V2P(v) >> PGSHIFT] - 1;
+  if(n >= 0)
+    swaptable.ref[n]++;
+  release(&swaptable.lock);
+  return n;
+}
+
+// Frame v is being freed; forget its copy in swap.
+// Called by kfree(), also before swapinit().
+void
+swapcachedel(char *v)
+{
+  if(swaptable.cache[V2P(v) >> PGSHIFT] == 0)
+    return;
+  acquire(&swaptable.lock);
+  if(swaptable.cache[V2P(v) >> PGSHIFT] != 0){
+    slotput(swaptable.cache[V2P(v) >> PGSHIFT] - 1);
+    swaptable.cache[V2P(v) >> PGSHIFT] = 0;
+  }
+  release(&swaptable.lock);
+}
+
+// Keep other swap I/O waiting, e.g. page-ins of pages that are
+// about to be written. The caller may do swap I/O meanwhile.
+void
+swaplock(void)
+{
+  acquiresleep(&swaptable.buf.lock);
+}
+
+void
+swapunlock(void)
+{
+  releasesleep(&swaptable.buf.lock);
+}
+
+// Move npages pages between pages[] and the consecutive
+// slots starting at slot n on disk. Caller holds swaptable.buf's lock.
+static void
+diskrw(int n, char **pages, int npages, int write)
+{
+  struct buf *b = &swaptable.buf;
+
+  b->dev = ROOTDEV;
+  b->blockno = sb.swapstart + n * (PGSIZE / BSIZE);
+  b->npages = npages;
+  b->pages = pages;
+  b->flags = write ? B_DIRTY : 0;
+  iderw(b);
+}
+
+// Compress the page at src into dst, which has room for max bytes:
+// runs of one repeated byte become a count and the byte, other
+// bytes are copied behind a count (PackBits). Returns the length,
+// or -1 if it doesn't fit.
+static int
+zcompress(char *src, char *dst, int max)
+{
+  int i, j, len;
+
+  for(i = len = 0; i < PGSIZE; i = j){
+    for(j = i + 1; j < PGSIZE && j - i < 129 && src[j] == src[i]; j++)
+      ;
+    if(j - i >= 2){
+      if(len + 2 > max)
+        return -1;
+      dst[len++] = 126 + (j - i);  // 128..255
+      dst[len++] = src[i];
+      continue;
+    }
+    for(; j < PGSIZE && j - i < 128 && !(j + 1 < PGSIZE && src[j] == src[j + 1]); j++)
+      ;
+    if(len + 1 + (j - i) > max)
+      return -1;
+    dst[len++] = j - i - 1;  // 0..127
+    memmove(dst + len, src + i, j - i);
+    len += j - i;
+  }
+  return len;
+}
+
+static void
+zdecompress(uchar *src, int len, char *dst)
+{
+  int i, n, out;
+
+  for(i = out = 0; i < len; out += n){
+    n = src[i] < 128 ? src[i] + 1 : src[i] - 126;
+    if(out + n > PGSIZE)
+      panic("zdecompress");
+    if(src[i] < 128)
+      memmove(dst + out, src + i + 1, n);
+    else
+      memset(dst + out, src[i + 1], n);
+    i += src[i] < 128 ? 1 + n : 2;
+  }
+  if(out != PGSIZE)
+    panic("zdecompress");
+}
+
+// Drop the oldest entries of the pool until size more bytes fit,
+// writing the pages still in use to their slots on disk.
+static void
+zmakeroom(uint size)
+{
+  struct zhdr *h;
+  char *pages[1];
+  uint pos;
+  int live;
+
+  while(zpool.head - zpool.tail + size > ZPOOLSIZE){
+    pos = zpool.tail % ZPOOLSIZE;
+    h = (struct zhdr*)(zpool.data + pos);
+    if(h->len == 0){
+      zpool.tail += ZPOOLSIZE - pos;
+      continue;
+    }
+    acquire(&swaptable.lock);
+    live = swaptable.inpool[h->slot] == pos + 1;
+    release(&swaptable.lock);
+    if(live){
+      zdecompress((uchar*)(h + 1), h->len, zpool.page);
+      pages[0] = zpool.page;
+      diskrw(h->slot, pages, 1, 1);
+      acquire(&swaptable.lock);
+      if(swaptable.inpool[h->slot] == pos + 1)
+        swaptable.inpool[h->slot] = 0;
+      release(&swaptable.lock);
+    }
+    zpool.tail += ZSIZE(h->len);
+  }
+}
+
+// Keep page src in the pool as the contents of slot n.
+// Returns 0, or -1 if it doesn't compress well enough.
+static int
+zput(int n, char *src)
+{
+  struct zhdr *h;
+  uint pos;
+  int len;
+
+  if((len = zcompress(src, zpool.zbuf, ZMAXLEN)) < 0)
+    return -1;
+  pos = zpool.head % ZPOOLSIZE;
+  if(pos + ZSIZE(len) > ZPOOLSIZE){
+    // Doesn't fit before the end: pad, and go on at the start
+    zmakeroom(ZPOOLSIZE - pos);
+    ((struct zhdr*)(zpool.data + pos))->len = 0;
+    zpool.head += ZPOOLSIZE - pos;
+    pos = 0;
+  }
+  zmakeroom(ZSIZE(len));
+  h = (struct zhdr*)(zpool.data + pos);
+  h->slot = n;
+  h->len = len;
+  memmove(h + 1, zpool.zbuf, len);
+  zpool.head += ZSIZE(len);
+
+  acquire(&swaptable.lock);
+  swaptable.inpool[n] = pos + 1;
+  release(&swaptable.lock);
+  return 0;
+}
+
+// If the pool has slot n's page, decompress it into dst.
+// Returns 0, or -1 if the page is on disk.
+static int
+zget(int n, char *dst)
+{
+  struct zhdr *h;
+  uint pos;
+
+  acquire(&swaptable.lock);
+  pos = swaptable.inpool[n];
+  release(&swaptable.lock);
+  if(pos == 0)
+    return -1;
+  h = (struct zhdr*)(zpool.data + pos - 1);
+  zdecompress((uchar*)(h + 1), h->len, dst);
+  return 0;
+}
+
+// Move npages pages between pages[] and the consecutive
+// slots starting at slot n: through the pool where it can,
+// with one disk command for each run of the other pages.
+static void
+swaprw(int n, char **pages, int npages, int write)
+{
+  struct buf *b = &swaptable.buf;
+  int pooled[SWAPCLUSTER];
+  int locked, i, j;
+  uint64 start;
+
+  if(n < 0 || npages < 1 || npages > SWAPCLUSTER || n + npages > NSWAPSLOT ||
+     (n + npages) * (PGSIZE / BSIZE) > sb.nswap)
+    panic("swaprw");
+
+  start = rdtsc();
+  if(!(locked = holdingsleep(&b->lock)))
+    acquiresleep(&b->lock);
+  for(i = 0; i < npages; i++)
+    pooled[i] = (write ? zput(n + i, pages[i]) : zget(n + i, pages[i])) == 0;
+  for(i = 0; i < npages; i = j + 1){
+    for(j = i; j < npages && !pooled[j]; j++)
+      ;
+    if(j > i)
+      diskrw(n + i, pages + i, j - i, write);
+  }
+  if(!locked)
+    releasesleep(&b->lock);
+  myproc()->swap_cycles += rdtsc() - start;
+}
+
+// Write npages pages into the slots starting at n.
+void
+swapwrite(int n, char **pages, int npages)
+{
+  swaprw(n, pages, npages, 1);
+}
+
+// Read the pages held in the npages slots starting at n.
+void
+swapread(int n, char **pages, int npages)
+{
+  swaprw(n, pages, npages, 0);
+}
@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "mman.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -17,9 +18,9 @@
 int
 fetchint(uint addr, int *ip)
 {
-  struct proc *curproc = myproc();
+  uint end = userend(myproc(), addr);
 
-  if(addr >= curproc->total_size || addr+4 > curproc->total_size)
+  if(addr >= end || addr+4 > end)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -32,12 +33,12 @@ int
 fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
-  struct proc *curproc = myproc();
+  uint end = userend(myproc(), addr);
 
-  if(addr >= curproc->total_size)
+  if(addr >= end)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->total_size;
+  ep = (char*)end;
   for(s = *pp; s < ep; s++){
     if(*s == 0)
       return s - *pp;
@@ -59,16 +60,34 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
-  struct proc *curproc = myproc();
+  uint end;
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->total_size || (uint)i+size > curproc->total_size)
+  end = userend(myproc(), i);
+  if(size < 0 || (uint)i >= end || (uint)i+size > end)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Like argptr(), for a block the kernel is going to write to:
+// also check that the process may write there. The kernel can't
+// recover from a fault halfway through a copy, so a read-only
+// mapping has to be refused before it starts.
+int
+argwptr(int n, char **pp, int size)
+{
+  struct vma *v;
+
+  if(argptr(n, pp, size) < 0)
+    return -1;
+  // A block doesn't span two parts of the address space, see userend()
+  if((v = findvma(myproc(), (uint)*pp)) != 0 && !(v->prot & PROT_WRITE))
+    return -1;
+  return 0;
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -107,6 +126,19 @@ extern int sys_yield(void);
 extern int sys_light_page_flags(void);
 extern int sys_check_page_flags(void);
 extern int sys_turn_off_page_flags(void);
+extern int sys_set_ram_limit(void);
+extern int sys_set_policy(void);
+extern int sys_set_large_pages(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_madvise(void);
+extern int sys_mlock(void);
+extern int sys_munlock(void);
+extern int sys_getmemstats(void);
+extern int sys_shmrm(void);
 
 
 static int (*syscalls[])(void) = {
@@ -135,6 +167,19 @@ static int (*syscalls[])(void) = {
 [SYS_light_page_flags] sys_light_page_flags,
 [SYS_check_page_flags] sys_check_page_flags,
 [SYS_turn_off_page_flags] sys_turn_off_page_flags,
+[SYS_set_ram_limit] sys_set_ram_limit,
+[SYS_set_policy] sys_set_policy,
+[SYS_set_large_pages] sys_set_large_pages,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_madvise] sys_madvise,
+[SYS_mlock]   sys_mlock,
+[SYS_munlock] sys_munlock,
+[SYS_getmemstats] sys_getmemstats,
+[SYS_shmrm]   sys_shmrm,
 };
 
 void
@@ -24,4 +24,17 @@
 #define SYS_light_page_flags  23
 #define SYS_check_page_flags 24
 #define SYS_turn_off_page_flags 25
+#define SYS_set_ram_limit 26
+#define SYS_set_policy 27
+#define SYS_set_large_pages 28
+#define SYS_mmap 29
+#define SYS_munmap 30
+#define SYS_shmget 31
+#define SYS_shmat 32
+#define SYS_shmdt 33
+#define SYS_madvise 34
+#define SYS_mlock 35
+#define SYS_munlock 36
+#define SYS_getmemstats 37
+#define SYS_shmrm 38
 
@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -66,6 +67,46 @@ sys_dup(void)
   return fd;
 }
 
+// Does f copy to and from user memory holding a spinlock?
+static int
+spinlocked(struct file *f)
+{
+  return f->type == FD_PIPE || (f->type == FD_INODE && f->ip->type == T_DEV);
+}
+
+// Pipes and devices copy to and from user memory holding a spinlock,
+// when a page fault can't sleep to page anything in. Files copy
+// holding a block buffer, which a fault that reads the executable or
+// a mapped file may need itself. So such buffers are paged in and
+// pinned first, up to PINPAGES pages at a time. A read from a pipe or
+// device reads into the first ones only.
+static int
+pinnedrw(struct file *f, char *p, int n, int write)
+{
+  int i, n1, r;
+  uint held;
+
+  i = 0;
+  do {
+    n1 = min(n - i, PINPAGES*PGSIZE - (uint)(p + i) % PGSIZE);
+    if(pin((uint)(p + i), n1, !write, &held) < 0)
+      return i > 0 ? i : -1;
+    r = write ? filewrite(f, p + i, n1) : fileread(f, p + i, n1);
+    unpin((uint)(p + i), held);
+    if(r < 0)
+      return i > 0 ? i : -1;
+    i += r;
+  } while(r == n1 && i < n && (write || !spinlocked(f)));
+  return i;
+}
+
+// Does reading or writing f with the n bytes at p have to pin them?
+static int
+mustpin(struct file *f, char *p, int n)
+{
+  return spinlocked(f) || (f->type == FD_INODE && filebacked((uint)p, n));
+}
+
 int
 sys_read(void)
 {
@@ -73,8 +114,10 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0)
     return -1;
+  if(mustpin(f, p, n))
+    return pinnedrw(f, p, n, 0);
   return fileread(f, p, n);
 }
 
@@ -87,6 +130,8 @@ sys_write(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
     return -1;
+  if(mustpin(f, p, n))
+    return pinnedrw(f, p, n, 1);
   return filewrite(f, p, n);
 }
 
@@ -109,7 +154,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argwptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -427,7 +472,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argwptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -443,3 +488,31 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_mmap(void)
+{
+  int addr, len, prot, flags, fd, off;
+  struct file *f;
+
+  // addr is only a hint, and mmap() picks the address itself
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(4, &fd) < 0 || argint(5, &off) < 0)
+    return -1;
+  f = 0;
+  if(!(flags & MAP_ANON) && argfd(4, 0, &f) < 0)
+    return -1;
+  if(len <= 0 || off < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "memstats.h"
 
 
 int sys_yield(void)
@@ -102,7 +103,13 @@ int sys_light_page_flags(void){
     int flags;
 
     if ((argptr(0, (void*)&addr, sizeof(addr)) < 0 || argint(1, &flags))) return -1;
-    return light_page_flags(addr, flags);
+    myproc()->paging++;
+    if (split_large_page(myproc(), addr) < 0)
+        flags = -1;
+    else
+        flags = light_page_flags(addr, flags);
+    myproc()->paging--;
+    return flags;
 
 }
 
@@ -120,6 +127,96 @@ int sys_turn_off_page_flags(void){
     int flags;
 
     if ((argptr(0, (void*)&addr, sizeof(addr)) < 0 || argint(1, &flags))) return -1;
-    return turn_off_page_flags(addr, flags);
+    myproc()->paging++;
+    if (split_large_page(myproc(), addr) < 0)
+        flags = -1;
+    else
+        flags = turn_off_page_flags(addr, flags);
+    myproc()->paging--;
+    return flags;
 
 }
+
+int sys_set_ram_limit(void){
+    int npages;
+
+    if (argint(0, &npages) < 0) return -1;
+    return set_ram_limit(npages);
+}
+
+int sys_set_policy(void){
+    int policy, all;
+
+    if (argint(0, &policy) < 0 || argint(1, &all) < 0) return -1;
+    return set_policy(policy, all);
+}
+
+// Turn large pages for big heap regions on or off for the current
+// process. Large pages already mapped stay.
+int sys_set_large_pages(void){
+    int on;
+
+    if (argint(0, &on) < 0) return -1;
+    myproc()->large_pages = on;
+    return 0;
+}
+
+// Shared memory segments, see shm.c.
+int sys_shmget(void){
+    int key, size;
+
+    if (argint(0, &key) < 0 || argint(1, &size) < 0 || size <= 0) return -1;
+    return shmget(key, size);
+}
+
+int sys_shmat(void){
+    int id;
+
+    if (argint(0, &id) < 0) return -1;
+    return shmat(id);
+}
+
+int sys_shmdt(void){
+    int addr;
+
+    if (argint(0, &addr) < 0) return -1;
+    return shmdt(addr);
+}
+
+int sys_shmrm(void){
+    int id;
+
+    if (argint(0, &id) < 0) return -1;
+    return shmrm(id);
+}
+
+int sys_madvise(void){
+    int addr, len, advice;
+
+    if (argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &advice) < 0 || len <= 0) return -1;
+    return madvise(addr, len, advice);
+}
+
+int sys_mlock(void){
+    int addr, len;
+
+    if (argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0) return -1;
+    return mlock(addr, len);
+}
+
+int sys_munlock(void){
+    int addr, len;
+
+    if (argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0) return -1;
+    return munlock(addr, len);
+}
+
+// Copy the memory and paging counters of process pid (0 for the
+// caller) out to user space, see memstats.h.
+int sys_getmemstats(void){
+    int pid;
+    struct memstats *st;
+
+    if (argint(0, &pid) < 0 || argwptr(1, (void *) &st, sizeof(*st)) < 0) return -1;
+    return getmemstats(pid, st);
+}
@@ -55,6 +55,9 @@ trap(struct trapframe *tf)
       release(&tickslock);
     }
     lapiceoi();
+    // Not in the kernel, which may be changing the resident set
+    if(myproc() && (tf->cs&3) == DPL_USER)
+      policy_tick();
     break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
@@ -78,8 +81,10 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
       case T_PGFLT:
-          if (myproc() != 0 && (tf->cs & 3) == 3) {
-              if (page_fault_handler()) break;
+          // The kernel faults on user pages too, e.g. when read()
+          // fills a buffer that is still shared copy-on-write.
+          if (myproc() != 0 && ((tf->cs & 3) == 3 || rcr2() < KERNBASE)) {
+              if (page_fault_handler(tf->err)) break;
           }
 
 
@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct memstats;
 
 // system calls
 int fork(void);
@@ -45,3 +46,16 @@ int pfree(void* ap);
 int             light_page_flags(char *user_virtual_address, int flags);
 int             check_page_flags(char *user_virtual_address, int flags);
 int             turn_off_page_flags(char *user_virtual_address, int flags);
+int             set_ram_limit(int npages);
+int             set_policy(int policy, int all);
+int             set_large_pages(int on);
+void*           mmap(void *addr, int length, int prot, int flags, int fd, int offset);
+int             munmap(void *addr, int length);
+int             shmget(int key, int size);
+void*           shmat(int id);
+int             shmdt(void *addr);
+int             shmrm(int id);
+int             madvise(void *addr, int length, int advice);
+int             mlock(void *addr, int length);
+int             munlock(void *addr, int length);
+int             getmemstats(int pid, struct memstats *st);
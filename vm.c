@@ -9,6 +9,7 @@
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
+char *zeropage;  // mapped copy-on-write wherever a page of zeros is read
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -30,14 +31,19 @@ seginit(void) {
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages. A large page has no
+// PTEs; see splitlarge().
 pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc) {
     pde_t *pde;
     pte_t *pgtab;
 
     pde = &pgdir[PDX(va)];
-    if (*pde & PTE_P) {
+    if (*pde & PTE_PS) {
+        if (alloc)
+            panic("walkpgdir: large page");
+        return 0;
+    } else if (*pde & PTE_P) {
         pgtab = (pte_t *) P2V(PTE_ADDR(*pde));
     } else {
         if (!alloc || (pgtab = (pte_t *) kalloc()) == 0)
@@ -137,6 +143,9 @@ setupkvm(void) {
 void
 kvmalloc(void) {
     kpgdir = setupkvm();
+    if ((zeropage = kalloc()) == 0)
+        panic("kvmalloc: zero page");
+    memset(zeropage, 0, PGSIZE);
     switchkvm();
 }
 
@@ -185,29 +194,102 @@ inituvm(pde_t *pgdir, char *init, uint sz) {
     memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+total_size must already be mapped.
+// Map a new frame at user page uva of pgdir with permissions perm,
+// holding what segments segs[0..nseg) of file ip put there, zeros elsewhere.
+// ip must be locked if any of them reaches into the page.
+// Returns 0, or -1 if out of memory or ip can't be read.
 int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz) {
-    uint i, pa, n;
-    pte_t *pte;
+loadpage(pde_t *pgdir, struct inode *ip, struct segment *segs, int nseg, char *uva, int perm) {
+    char *mem;
+    uint lo, hi;
+    int i;
 
-    if ((uint) addr % PGSIZE != 0)
-        panic("loaduvm: addr must be page aligned");
-    for (i = 0; i < sz; i += PGSIZE) {
-        if ((pte = walkpgdir(pgdir, addr + i, 0)) == 0)
-            panic("loaduvm: address should exist");
-        pa = PTE_ADDR(*pte);
-        if (sz - i < PGSIZE)
-            n = sz - i;
-        else
-            n = PGSIZE;
-        if (readi(ip, P2V(pa), offset + i, n) != n)
-            return -1;
+    if ((mem = kalloc()) == 0)
+        return -1;
+    memset(mem, 0, PGSIZE);
+    for (i = 0; i < nseg; i++) {
+        lo = segs[i].vaddr > (uint) uva ? segs[i].vaddr : (uint) uva;
+        hi = segs[i].vaddr + segs[i].filesz;
+        if (hi > (uint) uva + PGSIZE)
+            hi = (uint) uva + PGSIZE;
+        if (lo < hi && readi(ip, mem + lo - (uint) uva, segs[i].off + lo - segs[i].vaddr, hi - lo) != hi - lo)
+            goto bad;
     }
+    if (mappages(pgdir, uva, PGSIZE, V2P(mem), perm) < 0)
+        goto bad;
+    return 0;
+
+    bad:
+    kfree(mem);
+    return -1;
+}
+
+// Map the zero page read-only at user page uva of pgdir. The first
+// write gives uva a frame of its own, see copy_on_write().
+// Returns 0, or -1 if out of memory.
+int
+mapzero(pde_t *pgdir, char *uva) {
+    if (mappages(pgdir, uva, PGSIZE, V2P(zeropage), PTE_U | PTE_COW) < 0)
+        return -1;
+    kincref(zeropage);
+    return 0;
+}
+
+// Map frame mem at user page uva of pgdir with permissions perm,
+// adding a reference for the mapping to the ones it already has.
+// Returns 0, or -1 if out of memory.
+int
+mapshared(pde_t *pgdir, char *uva, char *mem, int perm) {
+    if (mappages(pgdir, uva, PGSIZE, V2P(mem), perm) < 0)
+        return -1;
+    kincref(mem);
+    return 0;
+}
+
+// Does pte map the zero page?
+int
+zeromapped(pte_t *pte) {
+    return (*pte & PTE_P) && PTE_ADDR(*pte) == V2P(zeropage);
+}
+
+// Map a zeroed large page at uva of pgdir, which must be aligned to
+// LPGSIZE and have no page table yet.
+// Returns 0, or -1 if there is no large page free.
+int
+maplarge(pde_t *pgdir, char *uva) {
+    char *mem;
+
+    if ((uint) uva % LPGSIZE != 0 || pgdir[PDX(uva)] != 0)
+        panic("maplarge");
+    if ((mem = kalloclarge()) == 0)
+        return -1;
+    memset(mem, 0, LPGSIZE);
+    pgdir[PDX(uva)] = V2P(mem) | PTE_PS | PTE_P | PTE_W | PTE_U;
     return 0;
 }
 
+// If uva of pgdir is in a large page, map the same frames with a
+// page table instead, so they can be handled one page at a time.
+// They are all marked dirty, since which ones were written to is
+// unknown. Returns 1 if it split one, 0 if uva isn't in a large
+// page, or -1 if out of memory.
+int
+splitlarge(pde_t *pgdir, char *uva) {
+    pde_t *pde = &pgdir[PDX(uva)];
+    pte_t *pgtab;
+    uint i;
+
+    if (!(*pde & PTE_PS))
+        return 0;
+    if ((pgtab = (pte_t *) kalloc()) == 0)
+        return -1;
+    for (i = 0; i < NPTENTRIES; i++)
+        pgtab[i] = (PTE_ADDR(*pde) + i * PGSIZE) | (*pde & (PTE_P | PTE_W | PTE_U)) | PTE_D;
+    *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+    invlpg(uva);
+    return 1;
+}
+
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -228,20 +310,6 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz) {
             deallocuvm(pgdir, newsz, oldsz);
             return 0;
         }
-
-#ifdef LIFO
-        struct proc* p = myproc();
-        p->pages_on_ram[p->pages_on_ram_stack_pointer++] = (char *) a;
-#endif
-#ifdef SCFIFO
-        struct proc* p = myproc();
-        uint i;
-        // Find the first empty spot
-        for (i = 0; p->pages_on_ram[i] != 0 && i <= MAX_PSYC_PAGES; ++i);
-        if (i > MAX_PSYC_PAGES) panic("allocuvm couldn't find free spot");
-        p->pages_on_ram[i] = (char*)a;
-#endif
-
         memset(mem, 0, PGSIZE);
         if (mappages(pgdir, (char *) a, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0) {
             cprintf("allocuvm out of memory (2)\n");
@@ -260,13 +328,24 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz) {
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz) {
     pte_t *pte;
-    uint a, pa;
+    uint a, pa, i;
 
     if (newsz >= oldsz)
         return oldsz;
 
     a = PGROUNDUP(newsz);
     for (; a < oldsz; a += PGSIZE) {
+        if (pgdir[PDX(a)] & PTE_PS) {
+            // Callers split large pages that are only partly freed
+            if (a % LPGSIZE != 0 || a + LPGSIZE > oldsz)
+                panic("deallocuvm: part of a large page");
+            pa = PTE_ADDR(pgdir[PDX(a)]);
+            for (i = 0; i < NPTENTRIES; i++)
+                kfree(P2V(pa + i * PGSIZE));
+            pgdir[PDX(a)] = 0;
+            a += LPGSIZE - PGSIZE;
+            continue;
+        }
         pte = walkpgdir(pgdir, (char *) a, 0);
         if (!pte)
             a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -277,6 +356,9 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz) {
             char *v = P2V(pa);
             kfree(v);
             *pte = 0;
+        } else if ((*pte & PTE_PG) != 0) {
+            swapfree(PTE_SLOT(*pte));
+            *pte = 0;
         }
     }
     return newsz;
@@ -313,39 +395,117 @@ clearpteu(pde_t *pgdir, char *uva) {
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. Resident pages are not copied: both
+// processes map the same frame read-only, and writable
+// pages are marked PTE_COW so the first write copies them.
 pde_t *
 copyuvm(pde_t *pgdir, uint sz) {
     pde_t *d;
-    pte_t *pte;
-    uint pa, i, flags;
-    char *mem;
 
     if ((d = setupkvm()) == 0)
         return 0;
-    for (i = 0; i < sz; i += PGSIZE) {
-        uint should_copy = 1;
-        if ((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-            panic("copyuvm: pte should exist");
+    if (copyrange(pgdir, d, 0, sz, 0) < 0) {
+        freevm(d);
+        return 0;
+    }
+    return d;
+}
+
+// Share the user pages of pgdir in [start, end) with page table d,
+// as copyuvm() does. With clean, d's PTEs start out clean, e.g. so a
+// child only writes back what it dirtied of a shared file mapping.
+// Returns 0, or -1 if out of memory.
+int
+copyrange(pde_t *pgdir, pde_t *d, uint start, uint end, int clean) {
+    pte_t *pte, *dpte;
+    uint pa, i, flags;
+
+    for (i = start; i < end; i += PGSIZE) {
+        // fork() splits large pages first
+        if (pgdir[PDX(i)] & PTE_PS)
+            panic("copyuvm: large page");
+        // Heap never touched since sbrk(): nothing to share yet
+        if ((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & (PTE_P | PTE_PG)))
+            continue;
         if (*pte & PTE_PG) {
-            should_copy = 0;
-        } else if (!(*pte & PTE_P))
-            panic("copyuvm: page not present");
+            // Paged out: no frame to share, the child refers to the same swap slot
+            if ((dpte = walkpgdir(d, (void *) i, 1)) == 0)
+                return -1;
+            *dpte = *pte;
+            swapdup(PTE_SLOT(*pte));
+            continue;
+        }
+        if (*pte & PTE_W)
+            *pte = (*pte & ~PTE_W) | PTE_COW;
         pa = PTE_ADDR(*pte);
         flags = PTE_FLAGS(*pte);
+        if (clean)
+            flags &= ~PTE_D;
+        if (mappages(d, (void *) i, PGSIZE, pa, flags) < 0)
+            return -1;
+        kincref(P2V(pa));
+    }
+    return 0;
+}
+
+// Resolve a write to copy-on-write user page uva of the current
+// process, whose PTE is pte. If no other process maps the frame
+// anymore it is simply made writable again, otherwise the page gets
+// a private copy. Returns 0 if there is no memory for the copy.
+int
+copy_on_write(pte_t *pte, char *uva) {
+    uint pa, flags;
+    char *mem;
+
+    if (!(*pte & PTE_COW))
+        panic("copy_on_write");
+    pa = PTE_ADDR(*pte);
+    flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    if (krefcount(P2V(pa)) > 1) {
         if ((mem = kalloc()) == 0)
-            goto bad;
-        if (should_copy) memmove(mem, (char *) P2V(pa), PGSIZE);
-        if (mappages(d, (void *) i, PGSIZE, V2P(mem), flags) < 0)
-            goto bad;
-        pte = walkpgdir(d, (void *) i, 0);
-        if (!should_copy) *pte &= ~PTE_P;
+            return 0;
+        memmove(mem, P2V(pa), PGSIZE);
+        *pte = V2P(mem) | flags;
+        kfree(P2V(pa));
+    } else {
+        *pte = pa | flags;
     }
-    return d;
+    invlpg(uva);
+    return 1;
+}
 
-    bad:
-    freevm(d);
-    return 0;
+// Give up the frame behind user page uva of pgdir once its contents
+// are in swap slot. Only a non-present PTE_PG entry recording the
+// slot is left.
+void
+evict_frame(pde_t *pgdir, char *uva, int slot) {
+    pte_t *pte;
+    uint pa;
+
+    if ((pte = walkpgdir(pgdir, uva, 0)) == 0 || !(*pte & PTE_P))
+        panic("evict_frame");
+    pa = PTE_ADDR(*pte);
+    *pte = SLOT_PTE(slot) | (PTE_FLAGS(*pte) & ~PTE_P) | PTE_PG;
+    // Only the current address space can have TLB entries
+    if (pgdir == myproc()->pgdir)
+        invlpg(uva);
+    kfree(P2V(pa));
+}
+
+// Map frame mem, just filled from swap, at paged out user page uva,
+// whose PTE is pte. The frame is private, so a copy-on-write page
+// becomes writable. A non-present PTE is never in the TLB, so there
+// is nothing to flush.
+void
+map_swapped_in(pte_t *pte, char *uva, char *mem) {
+    uint flags;
+
+    if (!(*pte & PTE_PG))
+        panic("map_swapped_in");
+    flags = PTE_FLAGS(*pte) & ~(PTE_PG | PTE_A | PTE_D);
+    if (flags & PTE_COW)
+        flags = (flags & ~PTE_COW) | PTE_W;
+    *pte = V2P(mem) | flags | PTE_P;  // replaces the slot number
 }
 
 //PAGEBREAK!
@@ -391,11 +551,18 @@ int light_page_flags(char *user_virtual_address, int flags) {
     pte_t *pte;
 
     pte = walkpgdir(myproc()->pgdir, user_virtual_address, 0);
+    // Heap never touched since sbrk()
+    if (pte == 0 || !(*pte & (PTE_P | PTE_PG)))
+        return -1;
 
-    *pte |= flags;
     if (flags & PTE_W)
         myproc()->protected_pages--;
-    lcr3(V2P(myproc()->pgdir));
+    // A frame still shared with another process only becomes writable
+    // through a private copy.
+    if ((flags & PTE_W) && (*pte & PTE_P) && krefcount(P2V(PTE_ADDR(*pte))) > 1)
+        flags = (flags & ~PTE_W) | PTE_COW;
+    *pte |= flags;
+    invlpg(user_virtual_address);
     return 1;
 }
 
@@ -412,11 +579,15 @@ int turn_off_page_flags(char *user_virtual_address, int flags) {
     pte_t *pte;
 
     pte = walkpgdir(myproc()->pgdir, user_virtual_address, 0);
+    if (pte == 0 || !(*pte & (PTE_P | PTE_PG)))
+        return -1;
 
+    if (flags & PTE_W)
+        flags |= PTE_COW;
     *pte &= ~flags; //turn off the flag
     if (flags & PTE_W)
         myproc()->protected_pages++;
-    lcr3(V2P(myproc()->pgdir));
+    invlpg(user_virtual_address);
     return 1;
 }
 